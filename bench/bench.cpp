@@ -0,0 +1,215 @@
+// vi set: noexpandtab
+// License: BSD license
+// Author: Sergey Sikorskiy
+#include <hddl/hddl.h>
+
+// Writes count vendor files of homed-zigbee style devices into dn. Every device has the usual
+// string arrays and an options object nested depth levels deep.
+static void Generate(const String& dn, int vendors, int devices, int depth) {
+    for (int v = 0; v < vendors; ++v) {
+        const String vendor = "vendor" + AsString(v);
+        StringBuffer out;
+        out << "{" << EOL << "    \"" << vendor << "\": [";
+        for (int d = 0; d < devices; ++d) {
+            out << (d ? "," : "") << EOL << "        {" << EOL;
+            out << "            \"description\": \"" << vendor << " device " << d << " \\\"rev " << d % 7 << "\\\"\"," << EOL;
+            out << "            \"modelNames\": [\"" << vendor << ".model." << d << "\", \"" << vendor << ".m" << d << "\"]," << EOL;
+            out << "            \"manufacturerNames\": [\"" << vendor << "\", \"_TZ3000_" << d % 13 << "\"]," << EOL;
+            out << "            \"properties\": [\"battery\", \"status\"]," << EOL;
+            out << "            \"exposes\": [\"switch\", \"power\", \"energy\"]," << EOL;
+            out << "            \"options\": ";
+            for (int i = 0; i < depth; ++i)
+                out << "{\"level" << i << "\": [" << i << ", " << AsString(i * 2.5) << ", true, null], \"next\": ";
+            out << "{}";
+            for (int i = 0; i < depth; ++i)
+                out << "}";
+            out << EOL << "        }";
+        }
+        out << EOL << "    ]" << EOL << "}" << EOL;
+        SaveFile(AppendFileName(dn, vendor + ".json"), String(out));
+    }
+}
+
+// Best of repeat runs of fn, in microseconds.
+static int64 Best(int repeat, Function<void ()> fn) {
+    int64 best = INT64_MAX;
+    for (int i = 0; i < repeat; ++i) {
+        const int64 t0 = usecs();
+        fn();
+        best = min(best, usecs(t0));
+    }
+    return best;
+}
+
+// MB/s of the steps that have them, by name.
+static VectorMap<String, double> rate;
+
+static void PutResult(const char *name, int64 us, int64 bytes) {
+    Cout() << Format("%-24s %10.3f ms", name, us / 1000.0);
+    if (bytes && us) {
+        Cout() << Format(" %10.1f MB/s", bytes / (double)us);
+        rate.GetAdd(name) = bytes / (double)us;
+    }
+    Cout() << EOL;
+}
+
+// A line per step, its name and MB/s separated by a tab.
+static bool StoreBaseline(const String& fn) {
+    String s;
+    for (int i = 0; i < rate.GetCount(); ++i)
+        s << rate.GetKey(i) << "\t" << Format("%.1f", rate[i]) << "\n";
+    return SaveFile(fn, s);
+}
+
+// Reports the steps that are slower than in the baseline by more than tolerance percent, returns
+// their number or -1 if there is no baseline. Steps that only one side has are skipped.
+static int CheckBaseline(const String& fn, double tolerance) {
+    FileIn in;
+    if (!in.Open(fn))
+        return -1;
+    int slower = 0;
+    while (!in.IsEof()) {
+        const Vector<String> w = Split(in.GetLine(), '\t');
+        const double base = w.GetCount() == 2 ? ScanDouble(w[1]) : Null;
+        const double *r = IsNull(base) ? NULL : rate.FindPtr(w[0]);
+        if (r && *r < base * (1 - tolerance / 100)) {
+            Cout() << Format("%-24s %10.1f MB/s, %.1f MB/s in the baseline", w[0], *r, base) << EOL;
+            ++slower;
+        }
+    }
+    return slower;
+}
+
+static void PutHelp() {
+    Cout() <<
+    "Usage: bench [-options]\n"
+    "Times the hddl parse and render pipeline on a generated corpus\n"
+    "Options:\n"
+    "\th - help\n"
+    "\tv count - number of vendor files (default: 20)\n"
+    "\tn count - devices per vendor (default: 200)\n"
+    "\td depth - nesting depth of the device options (default: 3)\n"
+    "\tr count - runs of every step, the best one is reported (default: 5)\n"
+    "\tk directory - generate the corpus here and keep it (default: a temporary directory)\n"
+    "\tb file - fail if a step is slower than in this baseline, in MB/s\n"
+    "\tt percent - how much slower than the baseline a step may be (default: 10)\n"
+    "\ts file - store the MB/s of every step as a baseline\n";
+}
+
+CONSOLE_APP_MAIN {
+    int vendors = 20;
+    int devices = 200;
+    int depth = 3;
+    int repeat = 5;
+    String dn;
+    String baseline_fn;
+    String store_fn;
+    double tolerance = 10;
+
+    { // Handle command line arguments
+        const Vector<String>& cmdline = CommandLine();
+        for (int icount = cmdline.GetCount(), i = 0; i < icount; ++i) {
+            const String& v = cmdline[i];
+            if (v.GetCount() != 2 || v[0] != '-' || (v[1] != 'h' && i + 1 >= icount)) {
+                SetExitCode(3);
+                return PutHelp();
+            }
+            switch (v[1]) {
+            case 'v': vendors = max(StrInt(cmdline[++i]), 1); break;
+            case 'n': devices = max(StrInt(cmdline[++i]), 1); break;
+            case 'd': depth = max(StrInt(cmdline[++i]), 0); break;
+            case 'r': repeat = max(StrInt(cmdline[++i]), 1); break;
+            case 'k': dn = cmdline[++i]; break;
+            case 'b': baseline_fn = cmdline[++i]; break;
+            case 't': tolerance = max(StrDbl(cmdline[++i]), 0.0); break;
+            case 's': store_fn = cmdline[++i]; break;
+            default: return PutHelp();
+            }
+        }
+    }
+
+    const bool keep = !IsNull(dn);
+    if (!keep)
+        dn = GetTempFileName("hddl_bench");
+    if (!RealizeDirectory(dn)) {
+        Cerr() << "Couldn't create directory " << dn << EOL;
+        SetExitCode(1);
+        return;
+    }
+    Generate(dn, vendors, devices, depth);
+
+    Vector<String> content;
+    int64 bytes = 0;
+    for (const String& fn : FindAllPaths(dn, "*.json"))
+        bytes += content.Add(LoadFile(fn)).GetCount();
+    Cout() << vendors << " files, " << vendors * devices << " devices, depth " << depth << ", "
+           << bytes << " bytes, best of " << repeat << EOL;
+
+    PutResult("ParseJSON", Best(repeat, [&] {
+        for (const String& s : content)
+            ParseJSON(s);
+    }), bytes);
+    PutResult("json::Parse", Best(repeat, [&] {
+        for (const String& s : content)
+            json::Parse(~s);
+    }), bytes);
+    PutResult("json::Parse iterative", Best(repeat, [&] {
+        for (const String& s : content)
+            json::Parse(~s, 256);
+    }), bytes);
+    PutResult("json::Extract", Best(repeat, [&] {
+        for (const String& s : content) {
+            json::Arena arena;
+            json::Scanner p(s.Begin(), s.End());
+            json::Extract(p, [](const json::Key&) {}, arena);
+        }
+    }), bytes);
+
+    // The whole collection, and the share of CollectContent in it as the stats have it.
+    const Vector<String> field = { "modelNames", "manufacturerNames" };
+    int64 content_us = INT64_MAX;
+    int64 parse_us = INT64_MAX;
+    One<HOMEd> hd;
+    PutResult("HOMEd::CollectDir", Best(repeat, [&] {
+        hd.Create().Fields(field);
+        hd->CollectDir(dn);
+        int64 c = 0, p = 0;
+        for (const Stats::File& f : hd->GetStats().file) {
+            c += f.content;
+            p += f.parse;
+        }
+        content_us = min(content_us, c);
+        parse_us = min(parse_us, p);
+    }), bytes);
+    PutResult("  CollectContent", content_us, bytes);
+    PutResult("  Extract", parse_us, bytes);
+
+    // Rendering again reuses the sections, so every run renders a fresh collection.
+    for (const char *ext : { "md", "json", "html", "csv" }) {
+        const Vector<const Writer *> wv = { GetWriter(ext) };
+        int64 best = INT64_MAX;
+        for (int i = 0; i < repeat; ++i) {
+            hd.Create().Fields(field);
+            hd->CollectDir(dn);
+            const int64 t0 = usecs();
+            hd->Populate(wv);
+            best = min(best, usecs(t0));
+        }
+        PutResult(String("HOMEd::Populate ") + ext, best, 0);
+    }
+
+    if (!keep)
+        DeleteFolderDeep(dn);
+
+    if (!IsNull(store_fn) && !StoreBaseline(store_fn)) {
+        Cerr() << "Couldn't create file " << store_fn << EOL;
+        SetExitCode(1);
+    }
+    const int slower = IsNull(baseline_fn) ? 0 : CheckBaseline(baseline_fn, tolerance);
+    if (slower < 0) {
+        Cerr() << "Couldn't open file " << baseline_fn << EOL;
+        SetExitCode(1);
+    }
+    else if (slower)
+        SetExitCode(2);
+}
@@ -0,0 +1,78 @@
+// vi set: noexpandtab
+// License: BSD license
+// Author: Sergey Sikorskiy
+#include <hddl/hddl.h>
+
+// Nesting the iterative Parse allows, far below what runs the recursive one out of stack.
+static const int max_depth = 256;
+
+// The number of brackets bounds the nesting, below max_depth the recursive Parse is safe to run.
+static int CountBrackets(const char *b, const char *e) {
+    int n = 0;
+    for (const char *s = b; s < e; ++s)
+        n += *s == '{' || *s == '[';
+    return n;
+}
+
+// Runs one input through every reader of downloaded JSON. They may reject it, but must neither
+// crash nor read past its end, and both Parses have to agree where both can run.
+static void FuzzOne(const char *data, size_t size) {
+    // Exactly sized, so a sanitizer catches a scan past the end.
+    Buffer<char> b(max<size_t>(size, 1));
+    memcpy(b, data, size);
+    const char *e = b + size;
+
+    static const Vector<String> field = { "modelNames", "manufacturerNames" };
+    for (bool view : { false, true })
+        try {
+            json::Arena arena;
+            json::Scanner p(b, e);
+            json::Extract(p, [](const json::Key& k) { k.GetKey(); }, arena, view, &field,
+                          [](int, const String&) {});
+        }
+        catch(CParser::Error) {}
+    try {
+        json::Scanner p(b, e);
+        json::ExtractArray(p, field, [](const Vector<String>&) {});
+    }
+    catch(CParser::Error) {}
+
+    // Parse reads up to the first zero.
+    const String s(data, int(size));
+    const Value v = json::Parse(~s, max_depth);
+    if (CountBrackets(~s, s.End()) < max_depth) {
+        const Value r = json::Parse(~s);
+        if (v.IsError() != r.IsError() || (!v.IsError() && v != r))
+            Panic("json::Parse results differ");
+    }
+    json::Parse(~s, max_depth, true);
+}
+
+#ifdef flagLIBFUZZER
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    FuzzOne((const char *)data, size);
+    return 0;
+}
+
+#else
+
+// Every file named on the command line, or stdin, e.g. for AFL or to replay a crash.
+CONSOLE_APP_MAIN {
+    const Vector<String>& cmdline = CommandLine();
+    if (cmdline.IsEmpty()) {
+        const String s = LoadStream(Cin());
+        FuzzOne(~s, s.GetCount());
+    }
+    for (const String& fn : cmdline) {
+        const String s = LoadFile(fn);
+        if (s.IsVoid()) {
+            Cerr() << "Couldn't open file " << fn << EOL;
+            SetExitCode(1);
+            continue;
+        }
+        FuzzOne(~s, s.GetCount());
+    }
+}
+
+#endif
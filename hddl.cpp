@@ -1,348 +1,2682 @@
-// vi set: noexpandtab
-// License: BSD license
-// Author: Sergey Sikorskiy
-#include <Core/Core.h>
-
-using namespace Upp;
-
-namespace json {
-
-    struct Key : Moveable<Key>, ValueType<Key, 10011> {
-        Key(const Nuller&)                  { key = Null; line = Null; }
-        Key(const String& key, int line) : key(key), line(line) {}
-        Key() {}
-
-        // We provide these methods to allow automatic conversion of Key to/from Value
-        operator Value() const              { return RichToValue(*this); }
-        Key(const Value& v)                 { *this = v.Get<Key>(); }
-
-        String ToString() const             { return key; }
-        unsigned GetHashValue() const       { return key.GetHashValue(); }
-        void Serialize(Stream& s)           { s % key % line; }
-        bool operator==(const Key& b) const { return key == b.key; }
-        bool IsNullInstance() const         { return IsNull(key) && IsNull(line); }
-        int  Compare(const Key& b) const    { return key.Compare(b.key); }
-        // This type does not define XML nor Json serialization
-
-        const String& GetKey() const { return key; }
-        int GetLine() const { return line; }
-
-    protected:
-        String key;
-        int line;
-    };
-
-    Value Parse(CParser& p) {
-        p.UnicodeEscape();
-        if(p.IsDouble())
-            return p.ReadDouble();
-        if(p.IsString()) {
-            bool dt = p.IsChar2('\"', '\\');
-            String s = p.ReadString();
-            if(dt) {
-                CParser p(s);
-                if(p.Char('/') && p.Id("Date") && p.Char('(') && p.IsInt()) {
-                    int64 n = p.ReadInt64();
-                    if(!IsNull(n))
-                        return Time(1970, 1, 1) + n / 1000;
-                }
-            }
-            return s;
-        }
-        if(p.Id("null"))
-            return Null;
-        if(p.Id("true"))
-            return true;
-        if(p.Id("false"))
-            return false;
-        if(p.Char('{')) {
-            ValueMap m;
-            while(!p.Char('}')) {
-                const int line = p.GetLine();
-                const String key = p.ReadString();
-                p.PassChar(':');
-                m.Add(Key(key, line), Parse(p));
-                if(p.Char('}')) // Stray ',' at the end of list is allowed...
-                    break;
-                p.PassChar(',');
-            }
-            return m;
-        }
-        if(p.Char('[')) {
-            ValueArray va;
-            while(!p.Char(']')) {
-                va.Add(Parse(p));
-                if(p.Char(']')) // Stray ',' at the end of list is allowed...
-                    break;
-                p.PassChar(',');
-            }
-            return va;
-        }
-        p.ThrowError("Unrecognized JSON element");
-        return Null;
-    }
-
-    Value Parse(const char *s) {
-        try {
-            CParser p(s);
-            return Parse(p);
-        }
-        catch(CParser::Error e) {
-            return ErrorValue(e);
-        }
-    }
-
-}
-
-INITBLOCK {
-	Value::Register<json::Key>();
-}
-
-void PutHelp() {
-	Cout() << 
-    "Usage: hddl [-options]\n"
-    "HOMEd supported device list\n"
-	"Version: 0.2\n"
-	"Options:\n"
-	"\th - help\n"
-	"\td directory - base directory (default: GitHub website)\n"
-	"\tf file - output file name (default: stdout)\n";
-}
-
-void PutErrorOpt() {
-    Cerr() << "Invalid option(s)" << EOL;
-    SetExitCode(3);
-    PutHelp();
-}
-
-struct HOMEd {
-    HOMEd();
-
-    bool CollectDir(const String& dn);
-    bool CollectGitHub();
-    void Populate(Stream& os);
-
-protected:
-    bool CollectContent(const String& fn, const String& fin, const String& content);
-    void Populate(Stream& os, const String& fn, const String& alias);
-
-protected:
-    VectorMap<String, String> fnMap;
-    VectorMap<String, Vector<json::Key>> bMap;
-}; // struct HOMEd
-
-HOMEd::HOMEd() {
-    { // Map file name to human readable name.
-        fnMap.Add("lumi.json", "Aqara/Xiaomi");
-        fnMap.Add("hue.json", "Philips");
-        fnMap.Add("gledopto.json", "GLEDOPTO");
-        fnMap.Add("gs.json", "GS");
-        fnMap.Add("konke.json", "Konke");
-        fnMap.Add("lifecontrol.json", "Life Control");
-        fnMap.Add("orvibo.json", "ORVIBO");
-        fnMap.Add("perenio.json", "Perenio");
-        fnMap.Add("yandex.json", "Yandex");
-        fnMap.Add("sonoff.json", "Sonoff");
-        fnMap.Add("ikea.json", "IKEA");
-        fnMap.Add("tuya.json", "TUYA");
-        fnMap.Add("efekta.json", "Efekta");
-        fnMap.Add("modkam.json", "Modkam");
-        fnMap.Add("pushok.json", "PushOk");
-        fnMap.Add("bacchus.json", "Bacchus");
-        fnMap.Add("homed.json", "HOMEd");
-        fnMap.Add("slacky.json", "Slacky");
-        fnMap.Add("other.json", "...");
-    }
-}
-
-bool HOMEd::CollectContent(const String& fn, const String& fin, const String& content) {
-    // const bool known_fn = (fnMap.Find(fn) >= 0);
-    const Value js = json::Parse(content);
-    if (js.IsError()) {
-        Cerr() << "Failed to parse JSON file " << fin << EOL;
-        return false;
-    }
-
-    if (js.GetCount() == 0) {
-        Cerr() << "The JSON is empty. " << fin << EOL;
-        return false;
-    }
-
-    if (!js.Is<ValueMap>())
-        return false;
-    const ValueMap vm = js;
-    // DUMP(vm);
-
-    Vector<json::Key>& vd = bMap.GetAdd(fn);
-    if (fnMap.Find(fn) < 0)
-        // Register new section.
-        fnMap.Add(fn, GetFileTitle(fn));
-    for (int icount = vm.GetCount(), i = 0; i < icount; ++i) {
-        // Vector<json::Key>& vd = bMap.GetAdd(known_fn ? fn : vm.GetKey(i).Get<json::Key>().GetKey());
-        const ValueArray va = vm.GetValue(i);
-        for (const Value& v : va) {
-            if (v.Is<ValueMap>()) {
-                const ValueMap obj = v;
-                const int ind = obj.Find(json::Key("description", -1));
-                if (ind >= 0) {
-                    const json::Key& k = obj.GetKey(ind).Get<json::Key>();
-                    const int line = k.GetLine();
-                    const String& name = obj.GetValue(ind);
-                    vd.Add(json::Key(name, line));
-                }
-            }
-        }
-    }
-    return true;
-}
-
-bool HOMEd::CollectDir(const String& dn) {
-    Vector<String> fv = FindAllPaths(dn, "*.json");
-    for (const String& fin : fv) {
-        FileIn fi;
-        // DUMP(GetFileName(fin));
-        if (!fi.Open(fin)) {
-            Cerr() << "Couldn't open file " << fin << EOL;
-            return false;
-        }
-    
-        const String fn = GetFileName(fin);
-        const String content = LoadStream(fi);
-        if (!CollectContent(fn, fin, content))
-            return false;
-    }
-    return true;
-}
-
-bool HOMEd::CollectGitHub() {
-    const String api_url = "https://api.github.com/repos/u236/homed-service-zigbee/contents/deploy/data/usr/share/homed-zigbee";
-	HttpRequest http(api_url);
-	const String content = http.Method(HttpRequest::METHOD_GET).Execute();
-	if (content.IsVoid()) {
-		Cerr() << "Failed to execute GET request with error code " << http.GetStatusCode() << ". " << api_url << EOL;
-		return false;
-	}
-    const Value js = ParseJSON(content);
-    if (js.IsError()) {
-        Cerr() << "Failed to parse JSON content. " << api_url << EOL;
-		return false;
-    }
-
-    if (js.GetCount() == 0) {
-        Cerr() << "The JSON is empty." << EOL;
-		return false;
-    }
-
-    if (!js.Is<ValueArray>())
-        return false;
-
-    for (int icount = js.GetCount(), i = 0; i < icount; ++i) {
-        const Value& v = js[i];
-        if (v["type"] != "file")
-            continue;
-        // DUMP(v);
-        const String fn = v["name"];
-        if (GetFileExt(fn) != ".json")
-            continue;
-        const String download_url = v["download_url"];
-        HttpRequest http(download_url);
-        const String content = http.Method(HttpRequest::METHOD_GET).Execute();
-        if (content.IsVoid()) {
-            Cerr() << "Failed to execute GET request with error code " << http.GetStatusCode() << ". " << download_url << EOL;
-            return false;
-        }
-        if (!CollectContent(fn, download_url, content))
-            return false;
-    }
-    return true;
-}
-
-void HOMEd::Populate(Stream& os, const String& fn, const String& alias) {
-    const int bi = bMap.Find(fn);
-    os << "## " << alias;
-    os << EOL << EOL;
-    const Vector<json::Key>& kv = bMap[bi];
-    for (const json::Key& k: kv) {
-        const int line = k.GetLine();
-        os << "* [" << k.GetKey() << "](https://github.com/u236/homed-service-zigbee/blob/master/deploy/data/usr/share/homed-zigbee/" << fn << "#L" << line << ")";
-        os << EOL;
-    }
-    os << EOL;
-}
-
-void HOMEd::Populate(Stream& os) {
-    { // Create header.
-        os << "# ZigBee: Поддерживаемые устройства";
-        os << EOL << EOL;
-        os << "## Общие сведения";
-        os << EOL << EOL;
-        os << "Список поддерживаемых устройств невелик, но он периодически пополняется. Для добавления поддержки новых устройств можно создать запрос на [GitHub](https://github.com/u236/homed-service-zigbee/issues) или заглянуть в [чат проекта](https://t.me/homed_chat) в Telegram.";
-        os << EOL << EOL;
-        os << "Представленный ниже список поддерживаемых устройств формируется из файлов библиотеки устройств, в полу-автоматическом режиме, поэтому он может быть не совсем актуальным.";
-        os << EOL << EOL;
-    }
-
-    SortByValue(fnMap);
-    for (int icount = fnMap.GetCount(), i = 0; i < icount; ++i) {
-        const String& fn = fnMap.GetKey(i);
-        if (fn == "other.json")
-            continue;
-        Populate(os, fn, fnMap[i]);
-    }
-
-    // Handle other.json.
-    Populate(os, "other.json", "...");
-
-}
-
-CONSOLE_APP_MAIN {
-	// StdLogSetup(LOG_COUT|LOG_FILE);
-    
-    bool use_cout = true;
-    bool use_github = true;
-    FileOut fo;
-    String fon;
-    String dn;
-
-    { // Handle command line arguments
-        const Vector<String>& cmdline = CommandLine();
-        for (int icount = cmdline.GetCount(), last = icount - 1, i = 0; i < icount; ++i) {
-            const String& v = cmdline[i];
-            if(*v != '-')
-                return PutErrorOpt();
-            if (v.GetCount() > 1 && v[1] == '-') {
-                NEVER();
-            } else {
-                for (const char *s = ~v + 1; *s; ++s) {
-                    switch (*s) {
-                    case 'h': return PutHelp();
-                    case 'f':
-                        if (i < last && cmdline[i + 1][0] != '-')
-                            fon = cmdline[++i];
-                        use_cout = false;
-                        break;
-                    case 'd':
-                        if (i < last && cmdline[i + 1][0] != '-')
-                            dn = cmdline[++i];
-                        use_github = false;
-                        break;
-                    default:
-                        return PutErrorOpt();
-                    }
-                }
-            }
-        }
-    }
-
-	if (!use_cout && !fo.Open(fon)) {
-		Cerr() << "Couldn't create file " << fon << EOL;
-		return;
-	}
-
-    HOMEd hd;
-    if (!(use_github ? hd.CollectGitHub() : hd.CollectDir(dn))) {
-		Cerr() << "Couldn't collect data." << EOL;
-		return;
-    }
-    hd.Populate(use_cout ? Cout() : fo);
-}
+// vi set: noexpandtab
+// License: BSD license
+// Author: Sergey Sikorskiy
+#include "hddl.h"
+#ifdef PLATFORM_LINUX
+#include <sys/inotify.h>
+#include <poll.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(CPU_SSE2)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace json {
+
+    // Reads a value that is not an object nor an array, false if there is none.
+    static bool ReadScalar(CParser& p, Value& v) {
+        if(p.IsDouble())
+            v = p.ReadDouble();
+        else if(p.IsString()) {
+            bool dt = p.IsChar2('\"', '\\');
+            String s = p.ReadString();
+            v = s;
+            if(dt) {
+                CParser p(s);
+                if(p.Char('/') && p.Id("Date") && p.Char('(') && p.IsInt()) {
+                    int64 n = p.ReadInt64();
+                    if(!IsNull(n))
+                        v = Time(1970, 1, 1) + n / 1000;
+                }
+            }
+        }
+        else if(p.Id("null"))
+            v = Null;
+        else if(p.Id("true"))
+            v = true;
+        else if(p.Id("false"))
+            v = false;
+        else
+            return false;
+        return true;
+    }
+
+    Value Parse(CParser& p) {
+        p.UnicodeEscape();
+        Value v;
+        if(ReadScalar(p, v))
+            return v;
+        if(p.Char('{')) {
+            ValueMap m;
+            while(!p.Char('}')) {
+                const int line = p.GetLine();
+                const String key = p.ReadString();
+                p.PassChar(':');
+                m.Add(Key(key, line), Parse(p));
+                if(p.Char('}')) // Stray ',' at the end of list is allowed...
+                    break;
+                p.PassChar(',');
+            }
+            return m;
+        }
+        if(p.Char('[')) {
+            ValueArray va;
+            while(!p.Char(']')) {
+                va.Add(Parse(p));
+                if(p.Char(']')) // Stray ',' at the end of list is allowed...
+                    break;
+                p.PassChar(',');
+            }
+            return va;
+        }
+        p.ThrowError("Unrecognized JSON element");
+        return Null;
+    }
+
+    Value Parse(const char *s) {
+        try {
+            CParser p(s);
+            return Parse(p);
+        }
+        catch(CParser::Error e) {
+            return ErrorValue(e);
+        }
+    }
+
+    Value Parse(CParser& p, int max_depth, bool strict) {
+        // The objects and arrays around the current value, innermost last.
+        struct Open {
+            bool     object;
+            ValueMap m;
+            ValueArray a;
+            Key      key;               // Of the member being read.
+        };
+        Array<Open> open;
+        p.UnicodeEscape();
+        // Reads the key of the next member of the innermost object.
+        auto Member = [&] {
+            const int line = p.GetLine();
+            const String key = p.ReadString();
+            p.PassChar(':');
+            open.Top().key = Key(key, line);
+        };
+        for (;;) {
+            Value v;
+            if(!ReadScalar(p, v)) {
+                const bool object = p.Char('{');
+                if(!object && !p.Char('['))
+                    p.ThrowError("Unrecognized JSON element");
+                if(p.Char(object ? '}' : ']'))
+                    v = object ? Value(ValueMap()) : Value(ValueArray());
+                else {
+                    if(open.GetCount() >= max_depth)
+                        p.ThrowError("JSON nested too deep");
+                    open.Add().object = object;
+                    if(object)
+                        Member();
+                    continue;
+                }
+            }
+            // The value goes to its container, which may be complete with it, and so on out.
+            for (;;) {
+                if(open.IsEmpty())
+                    return v;
+                Open& o = open.Top();
+                if(o.object)
+                    o.m.Add(o.key, v);
+                else
+                    o.a.Add(v);
+                const char close = o.object ? '}' : ']';
+                if(!p.Char(close)) {
+                    p.PassChar(',');
+                    if(strict || !p.Char(close)) // Stray ',' at the end of list is allowed...
+                        break;
+                }
+                v = o.object ? Value(o.m) : Value(o.a);
+                open.Drop();
+            }
+            if(open.Top().object)
+                Member();
+        }
+    }
+
+    Value Parse(const char *s, int max_depth, bool strict) {
+        try {
+            CParser p(s);
+            return Parse(p, max_depth, strict);
+        }
+        catch(CParser::Error e) {
+            return ErrorValue(e);
+        }
+    }
+
+    // Number of '\n' in [b, e).
+    inline int CountLines(const char *b, const char *e) {
+        int n = 0;
+#ifdef CPU_SSE2
+        // Matches are accumulated per byte lane, which is summed before it can overflow.
+        const __m128i nl = _mm_set1_epi8('\n');
+        const __m128i zero = _mm_setzero_si128();
+        while (e - b >= 16) {
+            __m128i acc = zero;
+            for (int i = 0; i < 255 && e - b >= 16; ++i, b += 16)
+                acc = _mm_sub_epi8(acc, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)b), nl));
+            const __m128i sum = _mm_sad_epu8(acc, zero);
+            n += _mm_cvtsi128_si32(sum) + _mm_cvtsi128_si32(_mm_srli_si128(sum, 8));
+        }
+#elif defined(__ARM_NEON)
+        const uint8x16_t nl = vdupq_n_u8('\n');
+        while (e - b >= 16) {
+            uint8x16_t acc = vdupq_n_u8(0);
+            for (int i = 0; i < 255 && e - b >= 16; ++i, b += 16)
+                acc = vsubq_u8(acc, vceqq_u8(vld1q_u8((const uint8_t *)b), nl));
+            const uint64x2_t sum = vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(acc)));
+            n += int(vgetq_lane_u64(sum, 0) + vgetq_lane_u64(sum, 1));
+        }
+#endif
+        for (; b < e; ++b)
+            n += *b == '\n';
+        return n;
+    }
+
+    inline int CountTrailingZeros(dword x) {
+#ifdef COMPILER_MSC
+        unsigned long i;
+        _BitScanForward(&i, x);
+        return (int)i;
+#else
+        return __builtin_ctz(x);
+#endif
+    }
+
+    // First '"', '\\' or control character in [s, e), or e. String literals are mostly plain
+    // text, so this looks at 32 (AVX2) or 16 (SSE2, NEON) bytes per step.
+    inline const char *FindSpecial(const char *s, const char *e) {
+#if defined(__AVX2__)
+        {
+            const __m256i quote = _mm256_set1_epi8('\"');
+            const __m256i bslash = _mm256_set1_epi8('\\');
+            const __m256i ctrl = _mm256_set1_epi8(0x1F);
+            for (; e - s >= 32; s += 32) {
+                const __m256i v = _mm256_loadu_si256((const __m256i *)s);
+                const __m256i m = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, quote), _mm256_cmpeq_epi8(v, bslash)),
+                                                  _mm256_cmpeq_epi8(_mm256_max_epu8(v, ctrl), ctrl));
+                if (const dword mask = (dword)_mm256_movemask_epi8(m))
+                    return s + CountTrailingZeros(mask);
+            }
+        }
+#endif
+#if defined(CPU_SSE2)
+        const __m128i quote = _mm_set1_epi8('\"');
+        const __m128i bslash = _mm_set1_epi8('\\');
+        const __m128i ctrl = _mm_set1_epi8(0x1F);
+        for (; e - s >= 16; s += 16) {
+            const __m128i v = _mm_loadu_si128((const __m128i *)s);
+            const __m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, bslash)),
+                                           _mm_cmpeq_epi8(_mm_max_epu8(v, ctrl), ctrl));
+            if (const dword mask = (dword)_mm_movemask_epi8(m))
+                return s + CountTrailingZeros(mask);
+        }
+#elif defined(__ARM_NEON)
+        const uint8x16_t quote = vdupq_n_u8('\"');
+        const uint8x16_t bslash = vdupq_n_u8('\\');
+        const uint8x16_t space = vdupq_n_u8(' ');
+        for (; e - s >= 16; s += 16) {
+            const uint8x16_t v = vld1q_u8((const uint8_t *)s);
+            const uint8x16_t m = vorrq_u8(vorrq_u8(vceqq_u8(v, quote), vceqq_u8(v, bslash)), vcltq_u8(v, space));
+            const uint8x8_t any = vorr_u8(vget_low_u8(m), vget_high_u8(m));
+            if (vget_lane_u64(vreinterpret_u64_u8(any), 0))
+                break; // The scalar loop below finds it within this block.
+        }
+#endif
+        while (s < e && *s != '\"' && *s != '\\' && (byte)*s >= ' ')
+            ++s;
+        return s;
+    }
+
+    char *Arena::Alloc(int n) {
+        if (!ptr || end - ptr < n) {
+            const int sz = max(n, min(4096 << min(block.GetCount(), 4), 65536));
+            block.Add().Alloc(sz);
+            ptr = block.Top();
+            end = ptr + sz;
+        }
+        char *t = ptr;
+        ptr += n;
+        return t;
+    }
+
+    int Scanner::GetLine(const char *pos) {
+        ASSERT(pos >= lptr && pos <= ptr);
+        line += CountLines(lptr, pos);
+        lptr = pos;
+        return line;
+    }
+
+    void Scanner::ThrowError(const char *s) {
+        String msg;
+        msg << "(" << GetLine() << "): " << s;
+        throw CParser::Error(~msg);
+    }
+
+    void Scanner::Spaces() {
+        while (ptr < end) {
+            if ((byte)*ptr <= ' ')
+                ++ptr;
+            else if (*ptr == '/' && ptr + 1 < end && ptr[1] == '/') {
+                while (ptr < end && *ptr != '\n')
+                    ++ptr;
+            }
+            else if (*ptr == '/' && ptr + 1 < end && ptr[1] == '*') {
+                for (ptr += 2; !(ptr + 1 < end && ptr[0] == '*' && ptr[1] == '/'); ++ptr)
+                    if (ptr >= end)
+                        ThrowError("Unterminated comment");
+                ptr += 2;
+            }
+            else
+                break;
+        }
+    }
+
+    bool Scanner::Char(char c) {
+        if (!IsChar(c))
+            return false;
+        ++ptr;
+        Spaces();
+        return true;
+    }
+
+    void Scanner::PassChar(char c) {
+        if (!Char(c)) {
+            char h[] = "missing ' '";
+            h[9] = c;
+            ThrowError(h);
+        }
+    }
+
+    bool Scanner::ReadText(const char *& b, const char *& e) {
+        if (!IsString())
+            ThrowError("missing string");
+        bool esc = false;
+        for (b = ++ptr;; ++ptr) {
+            ptr = FindSpecial(ptr, end);
+            if (ptr >= end || *ptr == '\n')
+                ThrowError("Unterminated string");
+            if (*ptr == '\"')
+                break;
+            if (*ptr == '\\') {
+                esc = true;
+                if (++ptr >= end)
+                    ThrowError("Unterminated string");
+            }
+            // Other control characters are taken as they are.
+        }
+        e = ptr++;
+        Spaces();
+        return esc;
+    }
+
+    int Scanner::ReadHex4(const char *& s, const char *e) {
+        int c = 0;
+        for (int i = 0; i < 4; ++i, ++s) {
+            const int h = s < e ? ToLower(*s) : 0;
+            if (h >= '0' && h <= '9')
+                c = 16 * c + h - '0';
+            else if (h >= 'a' && h <= 'f')
+                c = 16 * c + h - 'a' + 10;
+            else
+                ThrowError("Invalid unicode escape");
+        }
+        return c;
+    }
+
+    String Scanner::Decode(const char *b, const char *e) {
+        StringBuffer r(int(e - b));
+        char *t = r.Begin();
+        r.SetLength(int(Decode(b, e, t) - t));
+        return String(r);
+    }
+
+    char *Scanner::Decode(const char *s, const char *e, char *t) {
+        // Escapes never decode to more bytes than they take, so t doesn't overflow.
+        while (s < e) {
+            if (*s != '\\') {
+                *t++ = *s++;
+                continue;
+            }
+            switch (*++s) {
+            case 'b': *t++ = '\b'; break;
+            case 'f': *t++ = '\f'; break;
+            case 'n': *t++ = '\n'; break;
+            case 'r': *t++ = '\r'; break;
+            case 't': *t++ = '\t'; break;
+            case 'u': {
+                int c = ReadHex4(++s, e);
+                if (c >= 0xD800 && c < 0xDC00 && s + 1 < e && s[0] == '\\' && s[1] == 'u') {
+                    const char *q = s + 2;
+                    const int lo = ReadHex4(q, e);
+                    if (lo >= 0xDC00 && lo < 0xE000) {
+                        c = 0x10000 + ((c - 0xD800) << 10) + (lo - 0xDC00);
+                        s = q;
+                    }
+                }
+                if (c < 0x80)
+                    *t++ = c;
+                else if (c < 0x800) {
+                    *t++ = 0xC0 | (c >> 6);
+                    *t++ = 0x80 | (c & 0x3F);
+                }
+                else if (c < 0x10000) {
+                    *t++ = 0xE0 | (c >> 12);
+                    *t++ = 0x80 | ((c >> 6) & 0x3F);
+                    *t++ = 0x80 | (c & 0x3F);
+                }
+                else {
+                    *t++ = 0xF0 | (c >> 18);
+                    *t++ = 0x80 | ((c >> 12) & 0x3F);
+                    *t++ = 0x80 | ((c >> 6) & 0x3F);
+                    *t++ = 0x80 | (c & 0x3F);
+                }
+                continue;
+            }
+            default: *t++ = *s; break; // '"', '\\', '/' and anything CParser passes as is.
+            }
+            ++s;
+        }
+        return t;
+    }
+
+    void Scanner::SkipValue() {
+        // Without recursion, so deep nesting in a downloaded file can't run out of stack. close
+        // has the closing brackets of the objects and arrays around the current value.
+        Vector<char> close;
+        const char *b, *e;
+        for (;;) {
+            if (IsString())
+                ReadText(b, e);
+            else if (Char('{')) {
+                if (!Char('}')) {
+                    close.Add('}');
+                    ReadText(b, e);
+                    PassChar(':');
+                    continue;
+                }
+            }
+            else if (Char('[')) {
+                if (!Char(']')) {
+                    close.Add(']');
+                    continue;
+                }
+            }
+            else {
+                for (b = ptr; ptr < end && (IsAlNum(*ptr) || *ptr == '-' || *ptr == '+' || *ptr == '.'); ++ptr)
+                    ;
+                const int n = int(ptr - b);
+                if (n == 0 || !(IsDigit(*b) || *b == '-' || *b == '+' || *b == '.' ||
+                                (n == 4 && memcmp(b, "null", 4) == 0) ||
+                                (n == 4 && memcmp(b, "true", 4) == 0) ||
+                                (n == 5 && memcmp(b, "false", 5) == 0)))
+                    ThrowError("Unrecognized JSON element");
+                Spaces();
+            }
+            // Past a value, close what ends with it and go on with the next member.
+            for (;;) {
+                if (close.IsEmpty())
+                    return;
+                if (!Char(close.Top())) {
+                    PassChar(',');
+                    if (!Char(close.Top())) // Stray ',' at the end of list is allowed...
+                        break;
+                }
+                close.Drop();
+            }
+            if (close.Top() == '}') {
+                ReadText(b, e);
+                PassChar(':');
+            }
+        }
+    }
+
+    inline bool IsText(const char *b, const char *e, const char *id) {
+        const size_t n = strlen(id);
+        return size_t(e - b) == n && memcmp(b, id, n) == 0;
+    }
+
+    int Extract(Scanner& p, const Event<const Key&>& description, Arena& arena, bool view,
+                const Vector<String> *fields, const Event<int, const String&>& value) {
+        struct Text : Moveable<Text> {
+            int field;
+            const char *b, *e;
+            bool esc;
+        };
+        Vector<Text> text;
+        if (!p.Char('{')) {
+            p.SkipValue();
+            return -1;
+        }
+        int count = 0;
+        const char *b, *e;
+        while (!p.Char('}')) {
+            ++count;
+            p.ReadText(b, e);
+            p.PassChar(':');
+            if (p.Char('['))
+                while (!p.Char(']')) {
+                    if (p.Char('{')) {
+                        Key device;
+                        bool found = false;
+                        bool described = false;
+                        text.Clear();
+                        while (!p.Char('}')) {
+                            // Only a description needs the line of its key.
+                            const char *key = p.GetPtr();
+                            const bool esc = p.ReadText(b, e);
+                            p.PassChar(':');
+                            auto Is = [&](const char *id) { return esc ? p.Decode(b, e) == id : IsText(b, e, id); };
+                            const bool desc = !found && Is("description");
+                            found = found || desc;
+                            int fi = -1;
+                            for (int i = 0; !desc && fields && i < fields->GetCount() && fi < 0; ++i)
+                                if (Is(~(*fields)[i]))
+                                    fi = i;
+                            if (desc && p.IsString()) {
+                                const int line = p.GetLine(key);
+                                const bool esc = p.ReadText(b, e);
+                                const int n = int(e - b);
+                                if (view && !esc)
+                                    device = Key(b, n, line);
+                                else {
+                                    char *t = arena.Alloc(n);
+                                    char *q = esc ? p.Decode(b, e, t) : (char *)memcpy(t, b, n) + n;
+                                    device = Key(t, int(q - t), line);
+                                }
+                                described = true;
+                            }
+                            else if (fi >= 0 && p.IsString()) {
+                                Text& t = text.Add();
+                                t.field = fi;
+                                t.esc = p.ReadText(t.b, t.e);
+                            }
+                            else if (fi >= 0 && p.Char('['))
+                                while (!p.Char(']')) {
+                                    if (p.IsString()) {
+                                        Text& t = text.Add();
+                                        t.field = fi;
+                                        t.esc = p.ReadText(t.b, t.e);
+                                    }
+                                    else
+                                        p.SkipValue();
+                                    if (p.Char(']')) // Stray ',' at the end of list is allowed...
+                                        break;
+                                    p.PassChar(',');
+                                }
+                            else
+                                p.SkipValue();
+                            if (p.Char('}')) // Stray ',' at the end of list is allowed...
+                                break;
+                            p.PassChar(',');
+                        }
+                        if (described) {
+                            description(device);
+                            for (const Text& t : text)
+                                value(t.field, t.esc ? p.Decode(t.b, t.e) : String(t.b, t.e));
+                        }
+                    }
+                    else
+                        p.SkipValue();
+                    if (p.Char(']')) // Stray ',' at the end of list is allowed...
+                        break;
+                    p.PassChar(',');
+                }
+            else
+                p.SkipValue();
+            if (p.Char('}')) // Stray ',' at the end of list is allowed...
+                break;
+            p.PassChar(',');
+        }
+        return count;
+    }
+
+    int ExtractArray(Scanner& p, const Vector<String>& fields, const Event<const Vector<String>&>& element) {
+        if (!p.Char('[')) {
+            p.SkipValue();
+            return -1;
+        }
+        int count = 0;
+        Vector<String> v;
+        const char *b, *e;
+        while (!p.Char(']')) {
+            ++count;
+            if (p.Char('{')) {
+                v.Clear();
+                v.SetCount(fields.GetCount());
+                while (!p.Char('}')) {
+                    const bool esc = p.ReadText(b, e);
+                    p.PassChar(':');
+                    int fi = -1;
+                    for (int i = 0; i < fields.GetCount() && fi < 0; ++i)
+                        if (esc ? p.Decode(b, e) == fields[i] : IsText(b, e, ~fields[i]))
+                            fi = i;
+                    if (fi >= 0 && p.IsString()) {
+                        const bool esc = p.ReadText(b, e);
+                        v[fi] = esc ? p.Decode(b, e) : String(b, e);
+                    }
+                    else
+                        p.SkipValue();
+                    if (p.Char('}')) // Stray ',' at the end of list is allowed...
+                        break;
+                    p.PassChar(',');
+                }
+                element(v);
+            }
+            else
+                p.SkipValue();
+            if (p.Char(']')) // Stray ',' at the end of list is allowed...
+                break;
+            p.PassChar(',');
+        }
+        return count;
+    }
+
+}
+
+INITBLOCK {
+	Value::Register<json::Key>();
+}
+
+void PutHelp() {
+	Cout() << 
+    "Usage: hddl [-options]\n"
+    "HOMEd supported device list\n"
+	"Version: 0.2\n"
+	"Options:\n"
+	"\th - help\n"
+	"\td directory - base directory (default: GitHub website)\n"
+	"\tt [ref] - download the files of a branch, tag or commit as one archive (default: master)\n"
+	"\tm file - collect the sources listed in file at once into one list instead\n"
+	"\tf file - output file name (default: stdout)\n"
+	"\tj count - number of concurrent persistent connections (default: 1)\n"
+	"\tc directory - cache directory (default: none)\n"
+	"\tC file - vendor names and the link prefix of the upstream files in place of the built-in ones\n"
+	"\tz - refer to descriptions in the loaded files instead of copying them\n"
+	"\tw - keep running and regenerate the output when a file in the directory changes\n"
+	"\ts port - serve the list over HTTP\n"
+	"\ti seconds - how often the served list is collected again (default: 600)\n"
+	"\to formats - comma separated output formats: md, json, html, csv (default: md)\n"
+	"\tS file - store a snapshot of the collected list\n"
+	"\tL file - load the list from a snapshot instead of collecting it\n"
+	"\te fields - comma separated device fields to extract, e.g. modelNames,exposes (default: none)\n"
+	"\tx field=value - list the devices that have value in field instead of the list\n"
+	"\tq model[,manufacturer] - tell where a model is defined instead of the list, can be repeated\n"
+	"\tb - read model[,manufacturer] lines from stdin and answer each like q\n"
+	"\t-stats - report timings and counters of every collection as JSON on stderr\n"
+	"\t-diff file - list the devices added, removed or changed since a snapshot instead of the list\n"
+	"Environment:\n"
+	"\tGITHUB_TOKEN - token for the requests to GitHub, which then allows far more of them per hour\n";
+}
+
+void PutErrorOpt() {
+    Cerr() << "Invalid option(s)" << EOL;
+    SetExitCode(3);
+    PutHelp();
+}
+
+void Columns::AppendRow(const Columns& src, int row, const Vector<int>& map) {
+    column.SetCount(max(column.GetCount(), src.column.GetCount()));
+    for (int i = 0; i < column.GetCount(); ++i) {
+        Column& c = column[i];
+        c.begin.Add(c.value.GetCount());
+        if (i < src.column.GetCount())
+            for (int j = src.column[i].begin[row], e = src.column[i].GetEnd(row); j < e; ++j)
+                c.value.Add(map[src.column[i].value[j]]);
+    }
+}
+
+void Columns::Append(const Columns& src, const Vector<int>& map) {
+    column.SetCount(max(column.GetCount(), src.column.GetCount()));
+    for (int i = 0; i < src.column.GetCount(); ++i) {
+        Column& c = column[i];
+        const Column& sc = src.column[i];
+        const int n = c.value.GetCount();
+        for (int b : sc.begin)
+            c.begin.Add(n + b);
+        for (int v : sc.value)
+            c.value.Add(map[v]);
+    }
+}
+
+static const char blob_url[] = "https://github.com/u236/homed-service-zigbee/blob/master/deploy/data/usr/share/homed-zigbee/";
+
+// Human readable names of the upstream files, sorted by file name for a binary search.
+static constexpr struct { const char *fn; const char *alias; } vendor_alias[] = {
+    { "bacchus.json",       "Bacchus" },
+    { "efekta.json",        "Efekta" },
+    { "gledopto.json",      "GLEDOPTO" },
+    { "gs.json",            "GS" },
+    { "homed.json",         "HOMEd" },
+    { "hue.json",           "Philips" },
+    { "ikea.json",          "IKEA" },
+    { "konke.json",         "Konke" },
+    { "lifecontrol.json",   "Life Control" },
+    { "lumi.json",          "Aqara/Xiaomi" },
+    { "modkam.json",        "Modkam" },
+    { "orvibo.json",        "ORVIBO" },
+    { "other.json",         "..." },
+    { "perenio.json",       "Perenio" },
+    { "pushok.json",        "PushOk" },
+    { "slacky.json",        "Slacky" },
+    { "sonoff.json",        "Sonoff" },
+    { "tuya.json",          "TUYA" },
+    { "yandex.json",        "Yandex" },
+};
+
+static constexpr int Compare(const char *a, const char *b) {
+    for (; *a && *a == *b; ++a, ++b)
+        ;
+    return (byte)*a - (byte)*b;
+}
+
+static constexpr bool IsVendorAliasSorted() {
+    for (int i = 1; i < __countof(vendor_alias); ++i)
+        if (Compare(vendor_alias[i - 1].fn, vendor_alias[i].fn) >= 0)
+            return false;
+    return true;
+}
+
+static_assert(IsVendorAliasSorted(), "vendor_alias has to be sorted by file name");
+
+// Built-in alias of file fn, NULL if there is none.
+static const char *FindVendorAlias(const char *fn) {
+    int l = 0;
+    int h = __countof(vendor_alias);
+    while (l < h) {
+        const int m = (l + h) / 2;
+        const int c = Compare(vendor_alias[m].fn, fn);
+        if (c == 0)
+            return vendor_alias[m].alias;
+        if (c < 0)
+            l = m + 1;
+        else
+            h = m;
+    }
+    return NULL;
+}
+
+struct MarkdownWriter : Writer {
+    const char *GetExt() const override                                     { return "md"; }
+    const char *GetContentType() const override                             { return "text/markdown; charset=utf-8"; }
+
+    void Header(StringBuffer& out, const Vector<String>& field) const override {
+        out << "# ZigBee: Поддерживаемые устройства";
+        out << EOL << EOL;
+        out << "## Общие сведения";
+        out << EOL << EOL;
+        out << "Список поддерживаемых устройств невелик, но он периодически пополняется. Для добавления поддержки новых устройств можно создать запрос на [GitHub](https://github.com/u236/homed-service-zigbee/issues) или заглянуть в [чат проекта](https://t.me/homed_chat) в Telegram.";
+        out << EOL << EOL;
+        out << "Представленный ниже список поддерживаемых устройств формируется из файлов библиотеки устройств, в полу-автоматическом режиме, поэтому он может быть не совсем актуальным.";
+        out << EOL << EOL;
+    }
+
+    void Section(StringBuffer& out, const String& fn, const String& alias, const Vector<json::Key>& kv, const FieldValues& fields) const override {
+        out << "## " << alias;
+        out << EOL << EOL;
+        for (int i = 0; i < kv.GetCount(); ++i) {
+            const json::Key& k = kv[i];
+            out << "* [";
+            out.Cat(k.GetText(), k.GetLength());
+            out << "](" << fields.GetLink(i) << k.GetLine() << ")";
+            out << EOL;
+        }
+        out << EOL;
+    }
+};
+
+struct JsonWriter : Writer {
+    const char *GetExt() const override                                     { return "json"; }
+    const char *GetContentType() const override                             { return "application/json"; }
+    int  GetOverhead() const override                                       { return 64; }
+    void Header(StringBuffer& out, const Vector<String>& field) const override { out << "[" << EOL; }
+    void Separator(StringBuffer& out) const override                        { out << "," << EOL; }
+    void Footer(StringBuffer& out) const override                           { out << EOL << "]" << EOL; }
+
+    // An open string, closed after the line number.
+    String Link(const String& url) const override {
+        const String s = AsJSON(url);
+        return s.Left(s.GetCount() - 1);
+    }
+
+    void Section(StringBuffer& out, const String& fn, const String& alias, const Vector<json::Key>& kv, const FieldValues& fields) const override {
+        out << "  {" << EOL;
+        out << "    \"file\": " << AsJSON(fn) << "," << EOL;
+        out << "    \"vendor\": " << AsJSON(alias) << "," << EOL;
+        out << "    \"devices\": [";
+        for (int i = 0; i < kv.GetCount(); ++i) {
+            const json::Key& k = kv[i];
+            out << (i ? "," : "") << EOL;
+            out << "      {\"description\": " << AsJSON(k.GetKey()) << ", \"line\": " << k.GetLine()
+                << ", \"url\": " << fields.GetLink(i) << k.GetLine() << "\"";
+            for (int f = 0; f < fields.name.GetCount(); ++f) {
+                out << ", " << AsJSON(fields.name[f]) << ": [";
+                const Vector<String> v = fields.Get(f, i);
+                for (int j = 0; j < v.GetCount(); ++j)
+                    out << (j ? ", " : "") << AsJSON(v[j]);
+                out << "]";
+            }
+            out << "}";
+        }
+        out << (kv.GetCount() ? EOL "    " : "") << "]" << EOL;
+        out << "  }";
+    }
+};
+
+struct HtmlWriter : Writer {
+    const char *GetExt() const override                                     { return "html"; }
+    const char *GetContentType() const override                             { return "text/html; charset=utf-8"; }
+    int  GetOverhead() const override                                       { return 32; }
+
+    void Header(StringBuffer& out, const Vector<String>& field) const override {
+        out << "<!DOCTYPE html>" << EOL;
+        out << "<html>" << EOL;
+        out << "<head>" << EOL;
+        out << "<meta charset=\"utf-8\">" << EOL;
+        out << "<title>ZigBee: Поддерживаемые устройства</title>" << EOL;
+        out << "</head>" << EOL;
+        out << "<body>" << EOL;
+        out << "<h1>ZigBee: Поддерживаемые устройства</h1>" << EOL;
+        out << "<h2>Общие сведения</h2>" << EOL;
+        out << "<p>Список поддерживаемых устройств невелик, но он периодически пополняется. Для добавления поддержки новых устройств можно создать запрос на <a href=\"https://github.com/u236/homed-service-zigbee/issues\">GitHub</a> или заглянуть в <a href=\"https://t.me/homed_chat\">чат проекта</a> в Telegram.</p>" << EOL;
+        out << "<p>Представленный ниже список поддерживаемых устройств формируется из файлов библиотеки устройств, в полу-автоматическом режиме, поэтому он может быть не совсем актуальным.</p>" << EOL;
+    }
+
+    String Link(const String& url) const override                           { return DeXml(url); }
+
+    void Section(StringBuffer& out, const String& fn, const String& alias, const Vector<json::Key>& kv, const FieldValues& fields) const override {
+        out << "<h2>" << DeXml(alias) << "</h2>" << EOL;
+        out << "<ul>" << EOL;
+        for (int i = 0; i < kv.GetCount(); ++i) {
+            const json::Key& k = kv[i];
+            out << "<li><a href=\"" << fields.GetLink(i) << k.GetLine() << "\">" << DeXml(k.GetKey()) << "</a></li>" << EOL;
+        }
+        out << "</ul>" << EOL;
+    }
+
+    void Footer(StringBuffer& out) const override {
+        out << "</body>" << EOL;
+        out << "</html>" << EOL;
+    }
+};
+
+struct CsvWriter : Writer {
+    const char *GetExt() const override                                     { return "csv"; }
+    const char *GetContentType() const override                             { return "text/csv; charset=utf-8"; }
+    void Header(StringBuffer& out, const Vector<String>& field) const override {
+        out << "vendor,file,line,description,url";
+        for (const String& f : field)
+            out << "," << Field(f);
+        out << EOL;
+    }
+
+    // Quotes a field when it has to be.
+    static String Field(const String& s) {
+        if (s.FindFirstOf(",\"\r\n") < 0)
+            return s;
+        String r = "\"";
+        for (char c : s)
+            r << (c == '\"' ? "\"\"" : String(c, 1));
+        return r << "\"";
+    }
+
+    // A quoted field is closed after the line number.
+    String Link(const String& url) const override {
+        const String f = Field(url);
+        return *f == '\"' ? f.Left(f.GetCount() - 1) : f;
+    }
+
+    void Section(StringBuffer& out, const String& fn, const String& alias, const Vector<json::Key>& kv, const FieldValues& fields) const override {
+        const String prefix = Field(alias) + "," + Field(fn) + ",";
+        for (int i = 0; i < kv.GetCount(); ++i) {
+            const json::Key& k = kv[i];
+            const String& link = fields.GetLink(i);
+            out << prefix << k.GetLine() << "," << Field(k.GetKey()) << "," << link << k.GetLine() << (*link == '\"' ? "\"" : "");
+            // Several values of a field are separated by ';'.
+            for (int f = 0; f < fields.name.GetCount(); ++f)
+                out << "," << Field(Join(fields.Get(f, i), ";"));
+            out << EOL;
+        }
+    }
+};
+
+const Writer *GetWriter(const String& ext) {
+    static MarkdownWriter md;
+    static JsonWriter json;
+    static HtmlWriter html;
+    static CsvWriter csv;
+    static const Writer *writer[] = { &md, &json, &html, &csv };
+    for (const Writer *w : writer)
+        if (ext == w->GetExt())
+            return w;
+    return NULL;
+}
+
+int Stats::GetPhase(int http_phase) {
+    switch (http_phase) {
+    case HttpRequest::SSLPROXYREQUEST:
+    case HttpRequest::SSLPROXYRESPONSE:
+    case HttpRequest::SSLHANDSHAKE:
+        return TLS;
+    case HttpRequest::REQUEST:
+        return REQUEST;
+    case HttpRequest::HEADER:
+        return WAIT;
+    case HttpRequest::BODY:
+    case HttpRequest::CHUNK_HEADER:
+    case HttpRequest::CHUNK_BODY:
+    case HttpRequest::TRAILER:
+        return TRANSFER;
+    }
+    return DNS;
+}
+
+String Stats::ToJSON() const {
+    static const char *phase[] = { "dns", "tls", "request", "wait", "transfer" };
+    int64 bytes = 0;
+    int devices = 0;
+    JsonArray files;
+    for (const File& f : file) {
+        Json d;
+        for (int i = 0; i < PHASE_COUNT; ++i)
+            d(phase[i], f.download[i]);
+        files << Json("file", f.fin)("cached", f.cached)("bytes", f.bytes)("devices", f.devices)
+                     ("download", d)("parse", f.parse)("content", f.content);
+        bytes += f.bytes;
+        devices += f.devices;
+    }
+    return Json("listing", listing)("fetch", fetch)("collect", collect)("populate", populate)("load", load)
+               ("commit", commit)("bytes", bytes)("devices", devices)("peak_kb", MemoryUsedKbMax())("files", files);
+}
+
+void RateLimit::Wait() {
+    for (;;) {
+        int64 d;
+        {
+            // Starts in the same step it checks, so two threads don't take one slot.
+            Mutex::Lock __(lock);
+            const int64 now = usecs();
+            d = next - now;
+            if (d <= 0) {
+                next = now + interval;
+                return;
+            }
+        }
+        Sleep(int(min<int64>(d / 1000 + 1, 1000)));
+    }
+}
+
+void RateLimit::Update(HttpRequest& h) {
+    const int remaining = ScanInt(h.GetHeader("x-ratelimit-remaining"));
+    const int64 reset = ScanInt64(h.GetHeader("x-ratelimit-reset"));
+    if (IsNull(remaining) || IsNull(reset))
+        // Not limited, or not telling.
+        return;
+    const int limit = ScanInt(h.GetHeader("x-ratelimit-limit"));
+    const int64 left = max<int64>(reset - GetUTCSeconds(GetUtcTime()), 0) * 1000000;
+    Mutex::Lock __(lock);
+    if (remaining <= 0) {
+        // Nothing before the reset, a second late for the clocks that differ.
+        interval = 0;
+        next = max(next, usecs() + left + 1000000);
+    }
+    else
+        // At full speed, until the last tenth of the budget is spread over the time to the reset.
+        interval = !IsNull(limit) && remaining * 10 < limit ? left / remaining : 0;
+}
+
+int64 RateLimit::GetBackoff(HttpRequest& h, int attempt) const {
+    const int code = h.GetStatusCode();
+    const bool limited = code == 429 || (code == 403 && h.GetHeader("x-ratelimit-remaining") == "0");
+    // No status is a failed connection or transfer.
+    if (attempt >= MAX_ATTEMPTS || !(limited || code == 0 || code == 408 || code >= 500))
+        return Null;
+    const int64 d = min<int64>(500000LL << attempt, 32000000);
+    int64 r = d / 2 + Random(dword(d / 2));
+    const int64 after = ScanInt64(h.GetHeader("retry-after"));
+    if (!IsNull(after))
+        r = max(r, after * 1000000);
+    if (limited)
+        r = max(r, GetNext() - usecs());
+    return r;
+}
+
+RateLimit& RateLimits::Get(const String& url) {
+    const int q = url.Find("://");
+    const int b = q < 0 ? 0 : q + 3;
+    const int e = url.Find('/', b);
+    const String h = url.Mid(b, (e < 0 ? url.GetCount() : e) - b);
+    Mutex::Lock __(lock);
+    return host.GetAdd(h);
+}
+
+// Authenticated requests to GitHub get a budget of their own, far larger than the anonymous one.
+static void Authorize(HttpRequest& h, const String& url) {
+    static const String token = GetEnv("GITHUB_TOKEN");
+    if (!IsNull(token) && (url.StartsWith("https://api.github.com/") || url.StartsWith("https://raw.githubusercontent.com/")))
+        h.Header("Authorization", "Bearer " + token);
+}
+
+String Source::GetBlobUrl() const {
+    if (!IsNull(link))
+        return link;
+    if (kind == DIR)
+        return Null;
+    if (kind == URL)
+        return location.Left(location.ReverseFind('/') + 1);
+    return "https://github.com/" + location + "/blob/" + Nvl(ref, "HEAD") + "/" + path + "/";
+}
+
+bool Source::IsUpstream() const {
+    const Source upstream;
+    return (kind == GITHUB || kind == TARBALL) && location == upstream.location && path == upstream.path && IsNull(link);
+}
+
+String Source::ToString() const {
+    return Format("%d %s %s %s %s", kind, location, ref, path, link);
+}
+
+bool LoadSources(const String& fn, Vector<Source>& sv) {
+    FileIn in;
+    if (!in.Open(fn)) {
+        Cerr() << "Couldn't open file " << fn << EOL;
+        return false;
+    }
+    static const char *kind[] = { "github", "tarball", "dir", "url" };
+    for (int line = 1; !in.IsEof(); ++line) {
+        const String l = TrimBoth(in.GetLine());
+        if (IsNull(l) || *l == '#')
+            continue;
+        const Vector<String> w = Split(l, ' ');
+        Source& s = sv.Add();
+        s.kind = -1;
+        for (int i = 0; i < __countof(kind); ++i)
+            if (w[0] == kind[i])
+                s.kind = i;
+        const bool repo = s.kind == Source::GITHUB || s.kind == Source::TARBALL;
+        if (s.kind < 0 || w.GetCount() < 2 || w.GetCount() > (repo ? 4 : 3)) {
+            Cerr() << fn << ":" << line << ": invalid source" << EOL;
+            return false;
+        }
+        s.location = w[1];
+        if (!repo && w.GetCount() > 2)
+            s.link = w[2];
+        if (repo && w.GetCount() > 2)
+            s.ref = w[2];
+        if (repo && w.GetCount() > 3)
+            s.path = w[3];
+    }
+    return true;
+}
+
+bool LoadConfig(const String& fn, Config& cfg) {
+    FileIn in;
+    if (!in.Open(fn)) {
+        Cerr() << "Couldn't open file " << fn << EOL;
+        return false;
+    }
+    for (int line = 1; !in.IsEof(); ++line) {
+        const String l = TrimBoth(in.GetLine());
+        if (IsNull(l) || *l == '#')
+            continue;
+        const Vector<String> w = Split(l, ' ');
+        if (w[0] == "vendor" && w.GetCount() > 2) {
+            // The alias is the rest of the line, it may have spaces.
+            String& alias = cfg.alias.GetAdd(w[1]);
+            alias.Clear();
+            for (int i = 2; i < w.GetCount(); ++i)
+                alias << (i > 2 ? " " : "") << w[i];
+        } else if (w[0] == "link" && w.GetCount() == 2)
+            cfg.link = w[1];
+        else {
+            Cerr() << fn << ":" << line << ": invalid setting" << EOL;
+            return false;
+        }
+    }
+    return true;
+}
+
+void HOMEd::Cache::Serialize(Stream& s) {
+    int version = 3;
+    s / version;
+    if (version != 3) {
+        s.LoadError();
+        return;
+    }
+    s % etag % listing % entry % section % field;
+}
+
+void HOMEd::LoadCache() {
+    if (IsNull(cache_dir))
+        return;
+    if (!LoadFromFile(cache, GetCachePath()) || Join(cache.field, ",") != Join(field, ","))
+        // Missing or stale cache, or other fields were extracted, start from scratch.
+        cache = Cache();
+    cache.field = clone(field);
+}
+
+void HOMEd::StoreCache() {
+    for (HOMEd& h : part)
+        h.StoreCache();
+    if (IsNull(cache_dir))
+        return;
+    if (!RealizeDirectory(cache_dir) || !StoreToFile(cache, GetCachePath()))
+        Cerr() << "Couldn't store cache " << GetCachePath() << EOL;
+}
+
+void HOMEd::Serialize(Stream& s) {
+    int version = 5;
+    s / version;
+    if (version != 5) {
+        s.LoadError();
+        return;
+    }
+    s % vendor % field % pool % blob;
+    if (s.IsLoading())
+        order.Clear();
+}
+
+bool HOMEd::StoreSnapshot(const String& fn) {
+    return StoreToFile(*this, fn);
+}
+
+bool HOMEd::LoadSnapshot(const String& fn) {
+    // Load aside, a broken snapshot leaves the current list alone.
+    const int64 t0 = usecs();
+    HOMEd h;
+    if (LoadFromFile(h, fn)) {
+        // The cache isn't used for the list, but it is stored with the rendered sections.
+        LoadCache();
+        stats = Stats();
+        stats.load = usecs(t0);
+        vendor = pick(h.vendor);
+        // Named by the current configuration, not by the one the snapshot was stored with.
+        for (int i = 0; i < vendor.GetCount(); ++i)
+            vendor[i].alias = GetAlias(vendor.GetKey(i));
+        order.Clear();
+        field = pick(h.field);
+        pool = pick(h.pool);
+        blob = pick(h.blob);
+        part.Clear();
+        return true;
+    }
+    Cerr() << "Couldn't load snapshot " << fn << EOL;
+    return false;
+}
+
+bool HOMEd::Extract(const String& fin, const char *b, const char *e, json::Arena& arena, Entry& en) {
+    int count;
+    en.attr.column.SetCount(field.GetCount());
+    try {
+        json::Scanner p(b, e);
+        count = json::Extract(p, [&](const json::Key& k) { en.keys.Add(k); en.attr.AddRow(); }, arena, zero_copy,
+                              &field, [&](int f, const String& v) { en.attr.column[f].value.Add(en.pool.FindAdd(v)); });
+    }
+    catch(CParser::Error e) {
+        Cerr() << "Failed to parse JSON file " << fin << EOL;
+        return false;
+    }
+
+    if (count == 0) {
+        Cerr() << "The JSON is empty. " << fin << EOL;
+        return false;
+    }
+    return count > 0;
+}
+
+String HOMEd::GetAlias(const String& fn) const {
+    const String *alias = config ? config->alias.FindPtr(fn) : NULL;
+    const char *builtin = FindVendorAlias(fn);
+    return alias ? *alias : builtin ? String(builtin) : GetFileTitle(fn);
+}
+
+HOMEd::Vendor& HOMEd::GetVendor(const String& fn) {
+    int q = vendor.Find(fn);
+    if (q < 0) {
+        // Register new section.
+        q = vendor.GetCount();
+        vendor.Add(fn).alias = GetAlias(fn);
+        order.Clear();
+    }
+    return vendor[q];
+}
+
+void HOMEd::ClearList() {
+    // In place, so the vendor ids and the order of the list stay for the next collection.
+    for (int i = 0; i < vendor.GetCount(); ++i) {
+        Vendor& v = vendor[i];
+        v.hash = 0;
+        v.keys.Clear();
+        v.attr = Columns();
+        v.source.Clear();
+        v.seen = false;
+    }
+    pool.Clear();
+    lookup.Clear();
+    lookup_ref.Clear();
+}
+
+HOMEd& HOMEd::From(const Source& s) {
+    source = s;
+    blob = { s.IsUpstream() && config && !IsNull(config->link) ? config->link : s.GetBlobUrl() };
+    return *this;
+}
+
+String HOMEd::GetUpstreamUrl() const {
+    return config && !IsNull(config->link) ? config->link : String(blob_url);
+}
+
+void HOMEd::Merge(const String& fn, const Entry& e) {
+    Vendor& v = GetVendor(fn);
+    v.seen = true;
+    v.keys.Append(e.keys);
+    if (!field.IsEmpty()) {
+        // Move the values over to the shared pool.
+        Vector<int> map;
+        for (const String& s : e.pool)
+            map.Add(pool.FindAdd(s));
+        v.attr.Append(e.attr, map);
+    }
+    v.hash = int64((uint64)v.hash * 1000003 + (uint64)e.hash);
+}
+
+bool HOMEd::CollectContent(File& f, Entry& e) {
+    const int64 t0 = usecs();
+    Entry *c = cache.entry.FindPtr(f.fin);
+    if (!f.cached) {
+        f.hash = xxHash64(f.Begin(), f.End() - f.Begin());
+        f.cached = c && c->hash == f.hash;
+    }
+    if (f.cached)
+        // Unchanged since the last run, reuse the extracted keys.
+        e = pick(*c);
+    else {
+        const int64 t1 = usecs();
+        if (!Extract(f.fin, f.Begin(), f.End(), f.arena, e))
+            return false;
+        f.stat.parse = usecs(t1);
+        f.stat.bytes = f.End() - f.Begin();
+        e.hash = f.hash;
+    }
+    e.sha = f.sha;
+    e.etag = f.etag;
+    f.stat.content = usecs(t0);
+    return true;
+}
+
+bool HOMEd::Collect(Vector<File>& fv) {
+    // Files are independent, parse them in parallel, each one into its own entry. Cache entries
+    // are looked up by path, so every worker touches a different one.
+    const int64 t0 = usecs();
+    Vector<Entry> ev;
+    ev.SetCount(fv.GetCount());
+    Atomic failed(0);
+    CoFor(fv.GetCount(), [&](int i) {
+        if (!CollectContent(fv[i], ev[i]))
+            failed = 1;
+    });
+    const bool ok = Merge(fv, ev, failed);
+    stats.collect = usecs(t0);
+    return ok;
+}
+
+bool HOMEd::Merge(Vector<File>& fv, Vector<Entry>& ev, bool failed) {
+    if (failed) {
+        // Hand the reused entries back, the cache stays as it was. Files that never got to
+        // CollectContent left theirs in place.
+        for (int i = 0; i < fv.GetCount(); ++i)
+            if (Entry *c = fv[i].cached && !IsNull(ev[i].hash) ? cache.entry.FindPtr(fv[i].fin) : NULL)
+                *c = pick(ev[i]);
+        return false;
+    }
+
+    // Merge in the original order, so the result doesn't depend on scheduling.
+    ClearList();
+    part.Clear();
+    VectorMap<String, Entry> entry;
+    VectorMap<String, File> buf;
+    for (int i = 0; i < fv.GetCount(); ++i) {
+        File& f = fv[i];
+        f.stat.fin = f.fin;
+        f.stat.cached = f.cached;
+        f.stat.devices = ev[i].keys.GetCount();
+        stats.file.Add(f.stat);
+        Merge(f.fn, ev[i]);
+        entry.Add(f.fin, pick(ev[i]));
+        const int q = buffer.Find(f.fin);
+        if (!f.cached) {
+            if (!zero_copy) {
+                // The keys are in the arena, the content isn't needed anymore.
+                f.content.Clear();
+                f.map.Clear();
+            }
+            buf.Add(f.fin, pick(f));
+        }
+        else if (q >= 0)
+            // Reused keys may still refer to the buffer of a previous run.
+            buf.Add(f.fin, pick(buffer[q]));
+    }
+    cache.entry = pick(entry);
+    buffer = pick(buf);
+    return true;
+}
+
+bool HOMEd::Load(File& f) {
+    // Hand the mapped bytes to the parser, copy only what can't be mapped (e.g. empty files).
+    FileMapping& fm = f.map.Create();
+    if (fm.Open(f.fin) && fm.GetFileSize() > 0)
+        if (const byte *ptr = fm.Map(0, (size_t)fm.GetFileSize())) {
+            f.begin = (const char *)ptr;
+            f.end = f.begin + fm.GetFileSize();
+            return true;
+        }
+    f.map.Clear();
+
+    FileIn fi;
+    // DUMP(GetFileName(f.fin));
+    if (!fi.Open(f.fin)) {
+        Cerr() << "Couldn't open file " << f.fin << EOL;
+        return false;
+    }
+    f.content = LoadStream(fi);
+    return true;
+}
+
+bool HOMEd::ScanDir(const String& dn, const Index<String> *changed) {
+    stats = Stats();
+    Vector<File> fv;
+    for (const String& fin : FindAllPaths(dn, "*.json")) {
+        File& f = fv.Add();
+        f.fn = GetFileName(fin);
+        f.fin = fin;
+        if (changed && changed->Find(fin) < 0 && cache.entry.Find(fin) >= 0)
+            // Not touched since the last pass.
+            f.cached = true;
+        else if (!Load(f))
+            return false;
+    }
+    return Collect(fv);
+}
+
+bool HOMEd::CollectDir(const String& dn) {
+    LoadCache();
+    return ScanDir(dn, NULL);
+}
+
+bool HOMEd::UpdateDir(const String& dn, const Index<String>& changed) {
+    return ScanDir(dn, &changed);
+}
+
+String HOMEd::Execute(HttpRequest& http, const String& url, const String& etag, const Gate<>& done) {
+    RateLimit& limit = GetLimit(url);
+    for (int attempt = 0;; ++attempt) {
+        http.New();
+        http.ClearHeaders();
+        http.Url(url);
+        Authorize(http, url);
+        if (!IsNull(etag))
+            http.Header("If-None-Match", etag);
+        limit.Wait();
+        String content = http.Method(HttpRequest::METHOD_GET).Execute();
+        limit.Update(http);
+        const int64 d = done() ? Null : limit.GetBackoff(http, attempt);
+        if (IsNull(d))
+            return content;
+        Cerr() << "Retrying in " << d / 1000 << " ms, GET request failed with error code " << http.GetStatusCode() << ". " << url << EOL;
+        Sleep(int(d / 1000));
+    }
+}
+
+bool HOMEd::CollectGitHub() {
+    String api_url = "https://api.github.com/repos/" + source.location + "/contents/" + source.path;
+	if (!IsNull(source.ref))
+		api_url << "?ref=" << UrlEncode(source.ref);
+	LoadCache();
+	stats = Stats();
+	const int64 t0 = usecs();
+	HttpRequest http;
+	String content = Execute(http, api_url, cache.etag, [&] { return http.GetStatusCode() == 304 || http.IsSuccess(); });
+	if (http.GetStatusCode() == 304)
+		// The listing hasn't changed since the last run.
+		content = cache.listing;
+	else if (content.IsVoid()) {
+		Cerr() << "Failed to execute GET request with error code " << http.GetStatusCode() << ". " << api_url << EOL;
+		return false;
+	}
+	else {
+		cache.etag = http.GetHeader("etag");
+		cache.listing = content;
+	}
+    // Only these members of the entries are read, the rest is skipped without building values.
+    enum { TYPE, NAME, DOWNLOAD_URL, SHA };
+    static const Vector<String> member = { "type", "name", "download_url", "sha" };
+    Vector<File> fv;
+    int count;
+    try {
+        json::Scanner p(content.Begin(), content.End());
+        count = json::ExtractArray(p, member, [&](const Vector<String>& v) {
+            if (v[TYPE] != "file" || GetFileExt(v[NAME]) != ".json")
+                return;
+            File& f = fv.Add();
+            f.fn = v[NAME];
+            f.fin = v[DOWNLOAD_URL];
+            f.sha = v[SHA];
+            if (const Entry *e = cache.entry.FindPtr(f.fin)) {
+                // Same blob as last time, there is nothing to download.
+                f.cached = !IsNull(f.sha) && e->sha == f.sha;
+                f.etag = e->etag;
+            }
+        });
+    }
+    catch(CParser::Error e) {
+        Cerr() << "Failed to parse JSON content. " << api_url << EOL;
+		return false;
+    }
+
+    if (count == 0) {
+        Cerr() << "The JSON is empty." << EOL;
+		return false;
+    }
+
+    if (count < 0)
+        return false;
+    stats.listing = usecs(t0);
+
+    return FetchContent(fv);
+}
+
+bool HOMEd::FetchContent(Vector<File>& fv) {
+    // Parse every file as soon as it is here, on CoWork, while the other transfers go on.
+    const int64 t1 = usecs();
+    Vector<Entry> ev;
+    ev.SetCount(fv.GetCount());
+    Atomic failed(0);
+    CoWork co;
+    const bool ok = Fetch(fv, [&](int i) {
+        co & [this, &fv, &ev, &failed, i] {
+            if (!CollectContent(fv[i], ev[i]))
+                failed = 1;
+        };
+    });
+    co.Finish();
+    const bool merged = Merge(fv, ev, failed || !ok) && ok;
+    stats.collect = usecs(t1);
+    return merged;
+}
+
+// Splits a tar stream into its files as the bytes come. Names longer than the header has room
+// for come from pax or GNU headers, the pax global header has the commit of GitHub archives.
+struct TarReader {
+    Gate<const String&> Want;                           // Whether to keep the content of a file.
+    Event<const String&, String&> WhenFile;             // Path and content of a wanted file.
+
+    void   Put(const void *ptr, int size);
+    bool   IsError() const                             { return error; }
+    bool   IsEnd() const                               { return end; }
+    String GetComment() const                          { return comment; }
+
+protected:
+    char   header[512];
+    int    hlen = 0;                                    // Header bytes read so far.
+    int64  left = 0;                                    // Content bytes of the entry to come.
+    int    pad = 0;                                     // Bytes up to the next header after that.
+    int    type = 0;
+    bool   keep = false;
+    String path;
+    String next_path;                                   // Of the next entry, from a long name header.
+    String comment;
+    StringBuffer data;
+    bool   error = false;
+    bool   end = false;
+
+    static int64  GetOctal(const char *s, int n);
+    static String GetPax(const String& data, const char *key);
+    void   Header();
+    void   Done();
+};
+
+int64 TarReader::GetOctal(const char *s, int n) {
+    int64 r = 0;
+    for (const char *e = s + n; s < e && *s == ' '; ++s)
+        ;
+    for (const char *e = s + n; s < e && *s >= '0' && *s <= '7'; ++s)
+        r = r * 8 + (*s - '0');
+    return r;
+}
+
+String TarReader::GetPax(const String& data, const char *key) {
+    // Records are "<length> <key>=<value>\n", the length counts the whole record.
+    const int n = (int)strlen(key);
+    for (int i = 0, len; i < data.GetCount(); i += len) {
+        len = atoi(~data + i);
+        const int q = data.Find(' ', i);
+        if (len <= 0 || q < 0 || i + len > data.GetCount())
+            break;
+        if (q + n + 1 < i + len && memcmp(~data + q + 1, key, n) == 0 && data[q + n + 1] == '=')
+            return data.Mid(q + n + 2, i + len - q - n - 3);
+    }
+    return Null;
+}
+
+void TarReader::Header() {
+    int sum = 0;
+    bool zero = true;
+    for (int i = 0; i < 512; ++i) {
+        sum += i >= 148 && i < 156 ? ' ' : (byte)header[i];
+        zero = zero && header[i] == 0;
+    }
+    if (zero) {
+        // The archive ends with empty blocks.
+        end = true;
+        return;
+    }
+    if (sum != GetOctal(header + 148, 8) || (byte)header[124] & 0x80) {
+        // Not a header, or a size we don't expect in a source archive.
+        error = true;
+        return;
+    }
+    type = header[156];
+    left = GetOctal(header + 124, 12);
+    pad = int(-left & 511);
+    if (!IsNull(next_path))
+        path = next_path;
+    else {
+        path = String(header, (int)strnlen(header, 100));
+        if (memcmp(header + 257, "ustar", 5) == 0 && header[345])
+            path = String(header + 345, (int)strnlen(header + 345, 155)) + "/" + path;
+    }
+    next_path.Clear();
+    keep = type == 'x' || type == 'g' || type == 'L' || ((type == '0' || type == 0) && Want(path));
+    if (keep)
+        data.Reserve((int)min<int64>(left, INT_MAX / 2));
+    if (left == 0)
+        Done();
+}
+
+void TarReader::Done() {
+    if (!keep)
+        return;
+    String s(data);
+    data.Clear();
+    if (type == 'x')
+        next_path = GetPax(s, "path");
+    else if (type == 'g')
+        comment = GetPax(s, "comment");
+    else if (type == 'L')
+        next_path = String(~s, (int)strnlen(~s, s.GetCount()));
+    else
+        WhenFile(path, s);
+}
+
+void TarReader::Put(const void *ptr, int size) {
+    const char *s = (const char *)ptr;
+    const char *e = s + size;
+    while (s < e && !error && !end)
+        if (left > 0) {
+            const int n = (int)min<int64>(left, e - s);
+            if (keep)
+                data.Cat(s, n);
+            s += n;
+            left -= n;
+            if (left == 0)
+                Done();
+        }
+        else if (pad > 0) {
+            const int n = min(pad, int(e - s));
+            s += n;
+            pad -= n;
+        }
+        else {
+            const int n = min(512 - hlen, int(e - s));
+            memcpy(header + hlen, s, n);
+            hlen += n;
+            s += n;
+            if (hlen == 512) {
+                hlen = 0;
+                Header();
+            }
+        }
+}
+
+bool HOMEd::CollectTarball() {
+    const String api_url = "https://api.github.com/repos/" + source.location + "/tarball/" + UrlEncode(source.ref);
+    const String dir = source.path + "/";
+    // Entries are known by their download URLs, as in the contents listing.
+    const String raw_url = "https://raw.githubusercontent.com/" + source.location + "/" + Nvl(source.ref, "HEAD") + "/" + dir;
+    LoadCache();
+    stats = Stats();
+    const int64 t0 = usecs();
+
+    // Every wanted file is parsed as soon as it is out of the archive, while the rest is still
+    // coming. Array keeps the files and entries in place for the workers.
+    Array<File> af;
+    Array<Entry> ae;
+    Atomic failed(0);
+    CoWork co;
+    TarReader tar;
+    tar.Want = [&](const String& path) {
+        // The files of the data directory, below the top folder that is named after the commit.
+        const int q = path.Find('/') + 1;
+        return q > 0 && path.Mid(q, dir.GetCount()) == dir && path.Find('/', q + dir.GetCount()) < 0 &&
+               GetFileExt(path) == ".json";
+    };
+    tar.WhenFile = [&](const String& path, String& content) {
+        File& f = af.Add();
+        Entry& e = ae.Add();
+        f.fn = GetFileName(path);
+        f.fin = raw_url + f.fn;
+        f.content = pick(content);
+        co & [this, &f, &e, &failed] {
+            if (!CollectContent(f, e))
+                failed = 1;
+        };
+    };
+    Zlib zlib;
+    zlib.WhenOut = [&](const void *ptr, int size) { tar.Put(ptr, size); };
+    zlib.GZip().Decompress();
+
+    HttpRequest http;
+    http.MaxRedirects(5);
+    // An error body doesn't reach the archive, so a refused request can be repeated as is. One
+    // that breaks off in the middle of the archive can't.
+    bool streamed = false;
+    http.WhenContent = [&](const void *ptr, int size) {
+        if (http.GetStatusCode() / 100 == 2) {
+            streamed = true;
+            zlib.Put(ptr, size);
+        }
+    };
+    Execute(http, api_url, Null, [&] { return http.IsSuccess() || streamed; });
+    zlib.End();
+    co.Finish();
+    stats.fetch = usecs(t0);
+    stats.commit = tar.GetComment();
+
+    bool ok = false;
+    if (!http.IsSuccess())
+        Cerr() << "Failed to execute GET request with error code " << http.GetStatusCode() << ". " << api_url << EOL;
+    else if (zlib.IsError() || tar.IsError() || !tar.IsEnd())
+        Cerr() << "Failed to unpack the archive. " << api_url << EOL;
+    else if (af.IsEmpty())
+        Cerr() << "The archive has no device files. " << api_url << EOL;
+    else
+        ok = true;
+
+    Vector<File> fv;
+    Vector<Entry> ev;
+    for (int i = 0; i < af.GetCount(); ++i) {
+        fv.Add(pick(af[i]));
+        ev.Add(pick(ae[i]));
+    }
+    ok = Merge(fv, ev, failed || !ok) && ok;
+    stats.collect = usecs(t0);
+    return ok;
+}
+
+bool HOMEd::CollectUrl() {
+    LoadCache();
+    stats = Stats();
+    Vector<File> fv;
+    File& f = fv.Add();
+    f.fn = GetFileName(source.location);
+    f.fin = source.location;
+    if (const Entry *e = cache.entry.FindPtr(f.fin))
+        f.etag = e->etag;
+    return FetchContent(fv);
+}
+
+bool HOMEd::CollectSource() {
+    switch (source.kind) {
+    case Source::TARBALL:
+        return CollectTarball();
+    case Source::DIR:
+        return CollectDir(source.location);
+    case Source::URL:
+        return CollectUrl();
+    }
+    return CollectGitHub();
+}
+
+bool HOMEd::CollectSources(const Vector<Source>& sv) {
+    LoadCache();
+    stats = Stats();
+    const int64 t0 = usecs();
+    // Collect aside, the keys of the current list refer to the current parts.
+    Array<HOMEd> np;
+    for (const Source& s : sv) {
+        HOMEd& h = np.Add();
+        h.Jobs(jobs).ZeroCopy(zero_copy).Fields(field);
+        // Sources on the same host spend one budget.
+        h.shared_limits = shared_limits ? shared_limits : &limits;
+        if (config)
+            h.Configure(*config);
+        h.From(s);
+        if (!IsNull(cache_dir))
+            // The cache of a source is found by what the source is.
+            h.CacheDir(AppendFileName(cache_dir, Format64Hex(xxHash64(s.ToString()))));
+    }
+    Atomic failed(0);
+    CoFor(np.GetCount(), [&](int i) {
+        if (!np[i].CollectSource())
+            failed = 1;
+    });
+    if (failed)
+        return false;
+
+    ClearList();
+    blob.Clear();
+    // A device of a later source is dropped if an earlier one has it, in the same file with the
+    // same models, or description if there are no models. Those of one source all stay.
+    const bool by_model = FindIndex(field, String("modelNames")) >= 0;
+    Index<uint64> seen;                 // Devices of the sources so far.
+    for (int i = 0; i < np.GetCount(); ++i) {
+        const HOMEd& h = np[i];
+        const Vector<Device> dv = h.GetDevices(Vector<String>(), by_model);
+        Vector<uint64> id;
+        int di = 0;
+        blob.Add(h.blob[0]);
+        const uint64 bh = xxHash64(h.blob[0]);
+        Vector<int> map;
+        for (const String& s : h.pool)
+            map.Add(pool.FindAdd(s));
+        for (int j = 0; j < h.vendor.GetCount(); ++j) {
+            const String& fn = h.vendor.GetKey(j);
+            const Vendor& hv = h.vendor[j];
+            Vendor& v = GetVendor(fn);
+            v.seen = true;
+            if (!field.IsEmpty())
+                v.attr.column.SetCount(field.GetCount());
+            const uint64 fh = xxHash64(fn);
+            for (int k = 0; k < hv.keys.GetCount(); ++k) {
+                const uint64 d = fh * 1000003 + dv[di++].id;
+                if (seen.Find(d) >= 0)
+                    continue;
+                id.Add(d);
+                v.keys.Add(hv.keys[k]);
+                v.source.Add(i);
+                if (!field.IsEmpty())
+                    v.attr.AppendRow(hv.attr, k, map);
+            }
+            v.hash = int64(((uint64)v.hash * 1000003 + (uint64)hv.hash) * 1000003 + bh);
+        }
+        for (uint64 d : id)
+            seen.Add(d);
+        stats.listing += h.stats.listing;
+        stats.fetch += h.stats.fetch;
+        stats.file.Append(h.stats.file);
+    }
+    part = pick(np);
+    stats.collect = usecs(t0);
+    return true;
+}
+
+bool HOMEd::Fetch(Vector<File>& fv, const Event<int>& done) {
+    // Keep up to `jobs` requests in flight. Connections are persistent and each one is reused
+    // for the next file, so the TCP/TLS handshake is paid once per connection, not per file.
+    // Each body is stored at the index of its file, so the merge order does not depend on
+    // which transfer completes first. Files are handed to done as they are ready, those that
+    // need no download too, and only the file itself is touched after that. Requests start as
+    // fast as the rate limit allows, a failed one is repeated after a backoff while the other
+    // files go on.
+    const int64 t0 = usecs();
+    Array<HttpRequest> http;
+    Vector<int> fi;
+    Vector<int64> since;                // When the time of a request was last accounted.
+    for (int icount = min(jobs, fv.GetCount()), i = 0; i < icount; ++i) {
+        HttpRequest& h = http.Add();
+        h.KeepAlive();
+        h.Timeout(0);
+        fi.Add(-1);
+        since.Add(0);
+    }
+
+    int next = 0;
+    Vector<int> attempt;
+    attempt.SetCount(fv.GetCount(), 0);
+    Vector<int64> retry_at;             // When a failed file is due again.
+    retry_at.SetCount(fv.GetCount(), 0);
+    Vector<int> again;                  // Files waiting to be repeated.
+    auto Pending = [&] {
+        while (next < fv.GetCount() && fv[next].cached)
+            done(next++);
+        return next < fv.GetCount() || again.GetCount();
+    };
+    // The next file to request, -1 if none may start yet.
+    auto Take = [&] {
+        const int64 now = usecs();
+        for (int j = 0; j < again.GetCount(); ++j)
+            if (retry_at[again[j]] <= now && GetLimit(fv[again[j]].fin).GetNext() <= now) {
+                const int q = again[j];
+                again.Remove(j);
+                return q;
+            }
+        return next < fv.GetCount() && GetLimit(fv[next].fin).GetNext() <= now ? next++ : -1;
+    };
+    for (int active = 0; Pending() || active;) {
+        for (int i = 0; i < http.GetCount() && Pending(); ++i)
+            if (fi[i] < 0) {
+                const int q = Take();
+                if (q < 0)
+                    break;
+                const File& f = fv[q];
+                HttpRequest& h = http[i];
+                h.New();
+                h.ClearHeaders();
+                Authorize(h, f.fin);
+                if (!IsNull(f.etag))
+                    h.Header("If-None-Match", f.etag);
+                h.Url(f.fin).Method(HttpRequest::METHOD_GET);
+                GetLimit(f.fin).Start();
+                fi[i] = q;
+                since[i] = usecs();
+                ++active;
+            }
+
+        if (active) {
+            SocketWaitEvent we;
+            for (int i = 0; i < http.GetCount(); ++i)
+                if (fi[i] >= 0)
+                    we.Add(http[i], http[i].GetWaitEvents());
+            we.Wait(10);
+        }
+        else
+            // Waiting for the rate limit or a backoff.
+            Sleep(10);
+
+        for (int i = 0; i < http.GetCount(); ++i) {
+            if (fi[i] < 0)
+                continue;
+            HttpRequest& h = http[i];
+            File& f = fv[fi[i]];
+            // The time since the last step goes to the phase the request was waiting in.
+            const int phase = Stats::GetPhase(h.GetPhase());
+            h.Do();
+            const int64 now = usecs();
+            f.stat.download[phase] += now - since[i];
+            since[i] = now;
+            if (h.InProgress())
+                continue;
+            RateLimit& limit = GetLimit(f.fin);
+            limit.Update(h);
+            if (h.GetStatusCode() == 304)
+                f.cached = true;
+            else if (h.IsSuccess()) {
+                f.content = h.GetContent();
+                f.etag = h.GetHeader("etag");
+            }
+            else {
+                const int64 d = limit.GetBackoff(h, attempt[fi[i]]++);
+                if (IsNull(d)) {
+                    Cerr() << "Failed to execute GET request with error code " << h.GetStatusCode() << ". " << f.fin << EOL;
+                    return false;
+                }
+                Cerr() << "Retrying in " << d / 1000 << " ms, GET request failed with error code " << h.GetStatusCode() << ". " << f.fin << EOL;
+                retry_at[fi[i]] = now + d;
+                again.Add(fi[i]);
+                fi[i] = -1;
+                --active;
+                continue;
+            }
+            done(fi[i]);
+            fi[i] = -1;
+            --active;
+        }
+    }
+    stats.fetch = usecs(t0);
+    return true;
+}
+
+void HOMEd::Populate(StringBuffer& out, const Writer& w, int vi, const Vector<String>& url, int64 salt,
+                     VectorMap<String, Section>& section) {
+    const String& fn = vendor.GetKey(vi);
+    const Vendor& v = vendor[vi];
+    const String& alias = v.alias;
+    const int64 hash = int64((uint64)v.hash * 1000003 + (uint64)salt);
+    // Sections are cached per format.
+    const String id = String(w.GetExt()) + ":" + fn;
+    Section& sc = section.Add(id);
+    if (Section *c = cache.section.FindPtr(id))
+        if (c->hash == hash && c->alias == alias)
+            // None of the files of this section has changed.
+            sc = pick(*c);
+
+    if (!IsNull(sc.hash)) {
+        out.Cat(sc.text);
+        return;
+    }
+    // The links of a source differ in the line number only.
+    Vector<String> link;
+    for (const String& u : url)
+        link.Add(w.Link(u + fn + "#L"));
+    const int start = out.GetCount();
+    w.Section(out, fn, alias, v.keys, FieldValues { field, pool, &v.attr, link, v.source.GetCount() ? &v.source : NULL });
+    sc.hash = hash;
+    sc.alias = alias;
+    sc.text = String(out.Begin() + start, out.GetCount() - start);
+}
+
+Vector<String> HOMEd::Populate(const Vector<const Writer *>& wv) {
+    // Presize the buffers, so the whole list is rendered without reallocation. Every device
+    // takes its name, the link and the file name.
+    const int64 t0 = usecs();
+    int count = 0;
+    int size = 2048;
+    // Link prefix of every source, the upstream one in place of those with none.
+    const String upstream = GetUpstreamUrl();
+    Vector<String> url;
+    for (const String& b : blob)
+        url.Add(Nvl(b, upstream));
+    if (url.IsEmpty())
+        url.Add(upstream);
+    int link = 0;
+    for (const String& u : url)
+        link = max(link, u.GetCount() + 4);
+    // Vendors of files that are gone go with them, the built-in and configured ones stay and are
+    // listed, with devices or not.
+    for (int i = vendor.GetCount() - 1; i >= 0; --i) {
+        const String& fn = vendor.GetKey(i);
+        if (!vendor[i].seen && !FindVendorAlias(fn) && !(config && config->alias.Find(fn) >= 0)) {
+            vendor.Remove(i);
+            order.Clear();
+        }
+    }
+    for (const auto& a : vendor_alias)
+        GetVendor(a.fn);
+    if (config)
+        for (const String& fn : config->alias.GetKeys())
+            GetVendor(fn);
+    for (int i = 0; i < vendor.GetCount(); ++i) {
+        const Vector<json::Key>& kv = vendor[i].keys;
+        for (const json::Key& k : kv)
+            size += k.GetLength();
+        size += 64 + kv.GetCount() * (link + vendor.GetKey(i).GetCount());
+        count += kv.GetCount();
+    }
+    // The links are part of the sections, and so are the fields. A snapshot may have other fields
+    // than the cache the sections go to.
+    const int64 salt = xxHash64(Join(url, "\n") + "\n" + Join(field, ","));
+
+    if (order.IsEmpty()) {
+        // By alias, other.json goes last. It stays until the vendors change.
+        for (int i = 0; i < vendor.GetCount(); ++i)
+            order.Add(i);
+        auto Last = [&](int i) { return vendor.GetKey(i) == "other.json"; };
+        Sort(order, [&](int a, int b) {
+            return Last(a) != Last(b) ? Last(b) : vendor[a].alias != vendor[b].alias ? vendor[a].alias < vendor[b].alias
+                                                                                    : vendor.GetKey(a) < vendor.GetKey(b);
+        });
+    }
+
+    VectorMap<String, Section> section;
+    Vector<String> r;
+    for (const Writer *w : wv) {
+        StringBuffer out;
+        out.Reserve(size + count * w->GetOverhead());
+        w->Header(out, field);
+        for (int i = 0; i < order.GetCount(); ++i) {
+            if (i)
+                w->Separator(out);
+            Populate(out, *w, order[i], url, salt, section);
+        }
+        w->Footer(out);
+        r.Add(String(out));
+    }
+    cache.section = pick(section);
+    stats.populate = usecs(t0);
+    return r;
+}
+
+void HOMEd::Select(const String& name, const String& value, const Event<const String&, const json::Key&>& match) const {
+    const int f = FindIndex(field, name);
+    const int id = pool.Find(value);
+    if (f < 0 || id < 0)
+        return;
+    for (int i = 0; i < vendor.GetCount(); ++i) {
+        if (f >= vendor[i].attr.column.GetCount())
+            continue;
+        const Columns::Column& c = vendor[i].attr.column[f];
+        const Vector<json::Key>& kv = vendor[i].keys;
+        // Look for the id in the values, the device of a hit is found by walking begin along.
+        for (int j = 0, d = 0; j < c.value.GetCount(); ++j)
+            if (c.value[j] == id) {
+                while (c.GetEnd(d) <= j)
+                    ++d;
+                match(vendor.GetKey(i), kv[d]);
+                j = c.GetEnd(d) - 1;
+            }
+    }
+}
+
+void HOMEd::BuildLookup() {
+    lookup.Clear();
+    lookup_ref.Clear();
+    const int fm = FindIndex(field, "modelNames");
+    const int fv = FindIndex(field, "manufacturerNames");
+    if (fm < 0 || fv < 0)
+        return;
+    auto Add = [&](dword model, dword vendor, int section, int row) {
+        const uint64 id = ((uint64)model << 32) | vendor;
+        int q = lookup.Find(id);
+        if (q < 0) {
+            q = lookup.GetCount();
+            lookup.Add(id);
+            lookup_ref.Add();
+        }
+        Vector<Ref>& rv = lookup_ref[q];
+        if (rv.GetCount() && rv.Top().section == section && rv.Top().row == row)
+            // The same value twice in a device.
+            return;
+        Ref& r = rv.Add();
+        r.section = section;
+        r.row = row;
+    };
+    for (int i = 0; i < vendor.GetCount(); ++i) {
+        const Vector<Columns::Column>& column = vendor[i].attr.column;
+        if (max(fm, fv) >= column.GetCount())
+            continue;
+        const Columns::Column& m = column[fm];
+        const Columns::Column& v = column[fv];
+        for (int d = 0; d < m.begin.GetCount(); ++d)
+            for (int j = m.begin[d], je = m.GetEnd(d); j < je; ++j) {
+                Add(m.value[j], ~0u, i, d);
+                for (int k = v.begin[d], ke = v.GetEnd(d); k < ke; ++k)
+                    Add(m.value[j], v.value[k], i, d);
+            }
+    }
+}
+
+void HOMEd::Lookup(const String& model, const String& manufacturer, const Event<const String&, const json::Key&>& match) const {
+    const int m = pool.Find(model);
+    const int v = IsNull(manufacturer) ? ~0 : pool.Find(manufacturer);
+    if (m < 0 || (v < 0 && !IsNull(manufacturer)))
+        return;
+    const int q = lookup.Find(((uint64)m << 32) | (dword)v);
+    if (q >= 0)
+        for (const Ref& r : lookup_ref[q]) {
+            match(vendor.GetKey(r.section), vendor[r.section].keys[r.row]);
+        }
+}
+
+Vector<HOMEd::Device> HOMEd::GetDevices(const Vector<String>& fields, bool by_model) const {
+    Vector<int> fi;
+    for (const String& f : fields)
+        fi.Add(FindIndex(field, f));
+    const int fm = FindIndex(field, "modelNames");
+    Vector<Device> r;
+    for (int i = 0; i < vendor.GetCount(); ++i) {
+        const Vendor& v = vendor[i];
+        for (int d = 0; d < v.keys.GetCount(); ++d) {
+            auto Values = [&](int f) {
+                String s;
+                if (f >= 0 && f < v.attr.column.GetCount()) {
+                    const Columns::Column& c = v.attr.column[f];
+                    for (int j = c.begin[d], e = c.GetEnd(d); j < e; ++j)
+                        s << pool[c.value[j]] << "\n";
+                }
+                return s;
+            };
+            const String desc = v.keys[d].GetKey();
+            const String models = by_model ? Values(fm) : String();
+            // Without model names a device has nothing but its description.
+            String content = vendor.GetKey(i) + "\n" + desc + "\n";
+            for (int f : fi)
+                content << "\n" << Values(f);
+            Device& dv = r.Add();
+            dv.id = xxHash64(IsNull(models) ? "\n" + desc : models);
+            dv.content = xxHash64(content);
+            dv.ref.section = i;
+            dv.ref.row = d;
+        }
+    }
+    return r;
+}
+
+void HOMEd::Diff(const HOMEd& old, const Event<int, const String&, const json::Key&>& change) const {
+    // Compare the fields that both lists have.
+    Vector<String> fields;
+    for (const String& f : field)
+        if (FindIndex(old.field, f) >= 0)
+            fields.Add(f);
+    const bool by_model = FindIndex(fields, String("modelNames")) >= 0;
+    const Vector<Device> nd = GetDevices(fields, by_model);
+    const Vector<Device> od = old.GetDevices(fields, by_model);
+    Index<uint64> id;
+    for (const Device& d : od)
+        id.Add(d.id);
+    // The same device first, then one of the same id, so a duplicate pairs with its equal.
+    Vector<int> match;
+    match.SetCount(nd.GetCount(), -1);
+    Vector<int> paired;
+    paired.SetCount(od.GetCount(), -1);
+    for (int pass = 0; pass < 2; ++pass)
+        for (int i = 0; i < nd.GetCount(); ++i)
+            if (match[i] < 0)
+                for (int q = id.Find(nd[i].id); q >= 0; q = id.FindNext(q))
+                    if (paired[q] < 0 && (pass || od[q].content == nd[i].content)) {
+                        match[i] = q;
+                        paired[q] = i;
+                        break;
+                    }
+    auto Report = [&](int c, const HOMEd& h, const Ref& r) {
+        change(c, h.vendor.GetKey(r.section), h.vendor[r.section].keys[r.row]);
+    };
+    for (int i = 0; i < nd.GetCount(); ++i)
+        if (match[i] < 0)
+            Report('+', *this, nd[i].ref);
+        else if (od[match[i]].content != nd[i].content)
+            Report('~', *this, nd[i].ref);
+    for (int q = 0; q < od.GetCount(); ++q)
+        if (paired[q] < 0)
+            Report('-', old, od[q].ref);
+}
+
+bool SaveOutput(const String& fn, const String& text) {
+    const String tmp = fn + ".tmp";
+    FileOut fo;
+    if (!fo.Open(tmp))
+        return false;
+    fo.Put(text);
+    fo.Close();
+#ifdef PLATFORM_WIN32
+    // FileMove doesn't replace an existing file here, and deleting it first would leave a moment
+    // without one.
+    const bool moved = !fo.IsError() && MoveFileExW(ToSystemCharsetW(tmp), ToSystemCharsetW(fn), MOVEFILE_REPLACE_EXISTING);
+#else
+    const bool moved = !fo.IsError() && FileMove(tmp, fn);
+#endif
+    if (!moved) {
+        FileDelete(tmp);
+        return false;
+    }
+    return true;
+}
+
+// Reports changes of the *.json files below a directory. Uses inotify on Linux, elsewhere the
+// write times and sizes are compared once a second.
+class DirWatch {
+public:
+    ~DirWatch();
+
+    bool Open(const String& dn);
+    // Blocks until something changes, returns the paths of changed, new and removed files.
+    Index<String> Wait();
+
+protected:
+    String dir;
+#ifdef PLATFORM_LINUX
+    int fd = -1;
+    VectorMap<int, String> folder;      // Watched folders by watch descriptor.
+
+    bool Add(const String& dn);
+    bool Read(Index<String>& changed, int timeout);
+#else
+    VectorMap<String, String> stamp;    // Write time and size of every file by path.
+
+    VectorMap<String, String> Scan() const;
+#endif
+};
+
+#ifdef PLATFORM_LINUX
+DirWatch::~DirWatch() {
+    if (fd >= 0)
+        close(fd);
+}
+
+bool DirWatch::Open(const String& dn) {
+    dir = dn;
+    fd = inotify_init1(IN_CLOEXEC);
+    if (fd < 0)
+        return false;
+    if (!Add(dn))
+        return false;
+    for (const String& d : FindAllPaths(dn, "*", FINDALLFOLDERS))
+        if (!Add(d))
+            return false;
+    return true;
+}
+
+bool DirWatch::Add(const String& dn) {
+    // Editors either rewrite a file or save a new one over it.
+    const int wd = inotify_add_watch(fd, dn, IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_CREATE);
+    if (wd < 0)
+        return false;
+    folder.GetAdd(wd) = dn;
+    return true;
+}
+
+bool DirWatch::Read(Index<String>& changed, int timeout) {
+    pollfd pfd = { fd, POLLIN, 0 };
+    if (poll(&pfd, 1, timeout) <= 0)
+        return false;
+    alignas(inotify_event) char buf[4096];
+    const int n = (int)read(fd, buf, sizeof(buf));
+    for (int i = 0; i < n;) {
+        const inotify_event *ev = (const inotify_event *)(buf + i);
+        const String fn = AppendFileName(folder.Get(ev->wd, dir), ev->name);
+        if (ev->len && (ev->mask & IN_ISDIR) && (ev->mask & (IN_CREATE | IN_MOVED_TO))) {
+            // A new folder, watch it too and take the files that are already there.
+            Add(fn);
+            for (const String& d : FindAllPaths(fn, "*", FINDALLFOLDERS))
+                Add(d);
+            for (const String& f : FindAllPaths(fn, "*.json"))
+                changed.FindAdd(f);
+        }
+        else if (ev->len && GetFileExt(ev->name) == ".json")
+            changed.FindAdd(fn);
+        i += sizeof(inotify_event) + ev->len;
+    }
+    return n > 0;
+}
+
+Index<String> DirWatch::Wait() {
+    Index<String> changed;
+    // A save comes as several events, take everything that follows within 100ms.
+    for (int timeout = -1; Read(changed, timeout); timeout = 100)
+        ;
+    return changed;
+}
+#else
+DirWatch::~DirWatch() {}
+
+VectorMap<String, String> DirWatch::Scan() const {
+    VectorMap<String, String> r;
+    for (const String& fn : FindAllPaths(dir, "*.json"))
+        r.Add(fn, AsString(Time(GetFileTime(fn))) + " " + AsString(GetFileLength(fn)));
+    return r;
+}
+
+bool DirWatch::Open(const String& dn) {
+    dir = dn;
+    stamp = Scan();
+    return true;
+}
+
+Index<String> DirWatch::Wait() {
+    for (;;) {
+        Sleep(1000);
+        VectorMap<String, String> s = Scan();
+        Index<String> changed;
+        for (int i = 0; i < s.GetCount(); ++i)
+            if (stamp.Get(s.GetKey(i), Null) != s[i])
+                changed.Add(s.GetKey(i));
+        for (int i = 0; i < stamp.GetCount(); ++i)
+            if (s.Find(stamp.GetKey(i)) < 0)
+                changed.Add(stamp.GetKey(i));
+        stamp = pick(s);
+        if (!changed.IsEmpty())
+            return changed;
+    }
+}
+#endif
+
+// Serves the rendered list over HTTP/1.1 with keep-alive and ETag, /index.<ext> in every
+// format and / in the first one. A list is replaced as a whole, so a response is always one
+// complete version of it.
+class Server {
+public:
+    Server();
+
+    bool Listen(int port)               { return server.Listen(port, 64); }
+    void Set(const String& ext, const char *type, const String& text);
+    void Run();
+
+protected:
+    struct Body : Moveable<Body> {
+        String type;
+        String text;
+        String etag;
+    };
+
+    // Connections served at once, the next ones wait in the backlog of the socket.
+    enum { MAX_CONNECTIONS = 32 };
+
+    TcpSocket server;
+    Mutex lock;
+    VectorMap<String, Body> body;       // By extension.
+    Semaphore slot;                     // Counts the connections that may still start.
+
+    void Serve(TcpSocket& s);
+};
+
+Server::Server() {
+    for (int i = 0; i < MAX_CONNECTIONS; ++i)
+        slot.Release();
+}
+
+void Server::Set(const String& ext, const char *type, const String& text) {
+    const String tag = "\"" + Format64Hex(xxHash64(text)) + "\"";
+    Mutex::Lock __(lock);
+    Body& b = body.GetAdd(ext);
+    b.type = type;
+    b.text = text;
+    b.etag = tag;
+}
+
+void Server::Run() {
+    for (int failed = 0;;) {
+        slot.Wait();
+        TcpSocket *s = new TcpSocket;
+        if (!s->Accept(server)) {
+            delete s;
+            slot.Release();
+            // Mostly out of descriptors for a while, so don't spin until they are back.
+            if (failed++ == 0)
+                Cerr() << "Couldn't accept a connection. " << server.GetErrorDesc() << EOL;
+            Sleep(min(10 << min(failed, 7), 1000));
+            continue;
+        }
+        failed = 0;
+        // A thread per connection, so a slow client doesn't hold up the others.
+        Thread::Start([=] {
+            Serve(*s);
+            delete s;
+            slot.Release();
+        });
+    }
+}
+
+void Server::Serve(TcpSocket& s) {
+    s.Timeout(30000);
+    for (HttpHeader hdr; hdr.Read(s);) {
+        const String method = hdr.GetMethod();
+        String uri = hdr.GetURI();
+        const int q = uri.Find('?');
+        if (q >= 0)
+            uri.Trim(q);
+        Body b;
+        {
+            Mutex::Lock __(lock);
+            const int i = uri == "/" ? 0 : uri.StartsWith("/index.") ? body.Find(uri.Mid(7)) : -1;
+            if (i >= 0 && i < body.GetCount())
+                b = body[i];
+        }
+        const char *status = "200 OK";
+        if (method != "GET" && method != "HEAD")
+            status = "405 Method Not Allowed";
+        else if (IsNull(b.etag))
+            status = "404 Not Found";
+        else if (hdr["if-none-match"] == b.etag)
+            status = "304 Not Modified";
+        const bool ok = *status == '2';
+        const String& text = ok ? b.text : String();
+
+        String r;
+        r << "HTTP/1.1 " << status << "\r\n";
+        if (ok || *status == '3')
+            r << "Content-Type: " << b.type << "\r\n"
+              << "Cache-Control: no-cache\r\n"
+              << "ETag: " << b.etag << "\r\n";
+        r << "Content-Length: " << text.GetCount() << "\r\n\r\n";
+        if (!s.PutAll(r) || (method != "HEAD" && !s.PutAll(text)))
+            break;
+        if (hdr.GetVersion() != "HTTP/1.1" || ToLower(hdr["connection"]) == "close")
+            break;
+    }
+}
+
+#if !defined(flagBENCH) && !defined(flagFUZZ)
+
+CONSOLE_APP_MAIN {
+	// StdLogSetup(LOG_COUT|LOG_FILE);
+    
+    bool use_cout = true;
+    bool use_github = true;
+    int jobs = 1;
+    bool zero_copy = false;
+    bool watch = false;
+    int port = 0;
+    int interval = 600;
+    Vector<const Writer *> writer;
+    String fon;
+    String dn;
+    String cn;
+    String store_fn;
+    String load_fn;
+    String ref;
+    String sources_fn;
+    String config_fn;
+    Vector<String> field;
+    String select;
+    Vector<String> query;
+    bool batch = false;
+    bool stats = false;
+    String diff_fn;
+
+    { // Handle command line arguments
+        const Vector<String>& cmdline = CommandLine();
+        for (int icount = cmdline.GetCount(), last = icount - 1, i = 0; i < icount; ++i) {
+            const String& v = cmdline[i];
+            if(*v != '-')
+                return PutErrorOpt();
+            if (v.GetCount() > 1 && v[1] == '-') {
+                if (v == "--stats")
+                    stats = true;
+                else if (v == "--diff" && i < last && cmdline[i + 1][0] != '-')
+                    diff_fn = cmdline[++i];
+                else
+                    return PutErrorOpt();
+            } else {
+                for (const char *s = ~v + 1; *s; ++s) {
+                    switch (*s) {
+                    case 'h': return PutHelp();
+                    case 'f':
+                        if (i < last && cmdline[i + 1][0] != '-')
+                            fon = cmdline[++i];
+                        use_cout = false;
+                        break;
+                    case 'd':
+                        if (i < last && cmdline[i + 1][0] != '-')
+                            dn = cmdline[++i];
+                        use_github = false;
+                        break;
+                    case 't':
+                        ref = "master";
+                        if (i < last && cmdline[i + 1][0] != '-')
+                            ref = cmdline[++i];
+                        break;
+                    case 'm':
+                        if (i < last && cmdline[i + 1][0] != '-')
+                            sources_fn = cmdline[++i];
+                        else
+                            return PutErrorOpt();
+                        break;
+                    case 'c':
+                        if (i < last && cmdline[i + 1][0] != '-')
+                            cn = cmdline[++i];
+                        else
+                            return PutErrorOpt();
+                        break;
+                    case 'C':
+                        if (i < last && cmdline[i + 1][0] != '-')
+                            config_fn = cmdline[++i];
+                        else
+                            return PutErrorOpt();
+                        break;
+                    case 'S':
+                        if (i < last && cmdline[i + 1][0] != '-')
+                            store_fn = cmdline[++i];
+                        else
+                            return PutErrorOpt();
+                        break;
+                    case 'L':
+                        if (i < last && cmdline[i + 1][0] != '-')
+                            load_fn = cmdline[++i];
+                        else
+                            return PutErrorOpt();
+                        break;
+                    case 'e':
+                        if (i < last && cmdline[i + 1][0] != '-')
+                            field = Split(cmdline[++i], ',');
+                        else
+                            return PutErrorOpt();
+                        break;
+                    case 'x':
+                        if (i < last && cmdline[i + 1][0] != '-' && cmdline[i + 1].Find('=') > 0)
+                            select = cmdline[++i];
+                        else
+                            return PutErrorOpt();
+                        break;
+                    case 'q':
+                        if (i < last && cmdline[i + 1][0] != '-')
+                            query.Add(cmdline[++i]);
+                        else
+                            return PutErrorOpt();
+                        break;
+                    case 'b':
+                        batch = true;
+                        break;
+                    case 'z':
+                        zero_copy = true;
+                        break;
+                    case 'w':
+                        watch = true;
+                        break;
+                    case 's':
+                        if (i < last && cmdline[i + 1][0] != '-')
+                            port = ScanInt(cmdline[++i]);
+                        if (IsNull(port) || port < 1 || port > 65535)
+                            return PutErrorOpt();
+                        break;
+                    case 'i':
+                        if (i < last && cmdline[i + 1][0] != '-')
+                            interval = ScanInt(cmdline[++i]);
+                        if (IsNull(interval) || interval < 1)
+                            return PutErrorOpt();
+                        break;
+                    case 'o':
+                        if (i < last && cmdline[i + 1][0] != '-')
+                            for (const String& ext : Split(cmdline[++i], ',')) {
+                                const Writer *w = GetWriter(ToLower(ext));
+                                if (!w)
+                                    return PutErrorOpt();
+                                writer.Add(w);
+                            }
+                        else
+                            return PutErrorOpt();
+                        break;
+                    case 'j':
+                        if (i < last && cmdline[i + 1][0] != '-')
+                            jobs = ScanInt(cmdline[++i]);
+                        if (IsNull(jobs) || jobs < 1)
+                            return PutErrorOpt();
+                        break;
+                    default:
+                        return PutErrorOpt();
+                    }
+                }
+            }
+        }
+    }
+
+	if (watch && use_github)
+		// Only a local directory can be watched.
+		return PutErrorOpt();
+	if (!IsNull(load_fn) && (watch || !use_github))
+		// A snapshot replaces the source.
+		return PutErrorOpt();
+	if (!IsNull(ref) && (!use_github || !IsNull(load_fn)))
+		// The archive is another way to get the files from GitHub.
+		return PutErrorOpt();
+	if (!IsNull(sources_fn) && (!use_github || !IsNull(ref) || !IsNull(load_fn)))
+		// The sources file lists them all.
+		return PutErrorOpt();
+	Vector<Source> sources;
+	if (!IsNull(sources_fn) && !LoadSources(sources_fn, sources))
+		return;
+	Config config;
+	if (!IsNull(config_fn) && !LoadConfig(config_fn, config))
+		return;
+
+	if (writer.IsEmpty())
+		writer.Add(GetWriter("md"));
+	if (writer.GetCount() > 1 && use_cout && !port)
+		// Several formats need a file each.
+		return PutErrorOpt();
+	if (!use_cout && IsNull(fon))
+		// -f without a file name.
+		return PutErrorOpt();
+
+	// One format goes to the file as named, several to the name with the extension of each.
+	Vector<String> output;
+	for (const Writer *w : writer)
+		if (!use_cout)
+			output.Add(writer.GetCount() > 1 ? ForceExt(fon, String(".") + w->GetExt()) : fon);
+	for (const String& fn : output) {
+		// Fail before collecting when the output can't be written.
+		FileOut fo;
+		if (!fo.Open(fn + ".tmp")) {
+			Cerr() << "Couldn't create file " << fn << EOL;
+			return;
+		}
+		fo.Close();
+		FileDelete(fn + ".tmp");
+	}
+
+	// Start watching first, so nothing saved during the initial pass is missed.
+	DirWatch dw;
+	if (watch && !dw.Open(dn)) {
+		Cerr() << "Couldn't watch directory " << dn << EOL;
+		return;
+	}
+
+	Server srv;
+	if (port && !srv.Listen(port)) {
+		Cerr() << "Couldn't listen on port " << port << EOL;
+		return;
+	}
+
+	const int q = select.Find('=');
+	const String select_field = select.Left(max(q, 0));
+	Vector<String> need;                // Fields without which the answer would be empty.
+	if (!IsNull(select))
+		need.Add(select_field);
+	if (query.GetCount() || batch) {
+		need.Add("modelNames");
+		need.Add("manufacturerNames");
+	}
+	for (const String& f : need)
+		if (FindIndex(field, f) < 0)
+			field.Add(f);
+	if (!IsNull(diff_fn) && FindIndex(field, String("modelNames")) < 0)
+		// Devices are told apart by their models, if the snapshot has them too.
+		field.Add("modelNames");
+	HOMEd old;
+	if (!IsNull(diff_fn) && !old.LoadSnapshot(diff_fn))
+		return;
+
+    HOMEd hd;
+    hd.Jobs(jobs).CacheDir(cn).ZeroCopy(zero_copy).Fields(field).Configure(config);
+	if (!IsNull(ref)) {
+		Source s;
+		s.kind = Source::TARBALL;
+		s.ref = ref;
+		hd.From(s);
+	}
+	auto Collect = [&] {
+		return !IsNull(load_fn) ? hd.LoadSnapshot(load_fn) : sources.GetCount() ? hd.CollectSources(sources) :
+		       use_github ? hd.CollectSource() : hd.CollectDir(dn);
+	};
+    if (!Collect()) {
+		Cerr() << "Couldn't collect data." << EOL;
+		return;
+    }
+	for (const String& f : need)
+		if (FindIndex(hd.GetFields(), f) < 0) {
+			// A snapshot has the fields it was stored with.
+			Cerr() << "The snapshot " << load_fn << " has no field " << f << EOL;
+			SetExitCode(1);
+			return;
+		}
+	auto PutStats = [&] {
+		if (stats)
+			Cerr() << hd.GetStats().ToJSON() << EOL;
+	};
+
+	if (query.GetCount() || batch) {
+		// A line per device: model, manufacturer, where it is and its description, or '-' instead of
+		// the last two when there is none.
+		hd.BuildLookup();
+		Stream& out = Cout();
+		auto Answer = [&](const String& q) {
+			const int c = q.Find(',');
+			const String model = c < 0 ? q : q.Left(c);
+			const String manufacturer = c < 0 ? String() : q.Mid(c + 1);
+			bool found = false;
+			hd.Lookup(model, manufacturer, [&](const String& fn, const json::Key& k) {
+				out << model << "\t" << manufacturer << "\t" << fn << ":" << k.GetLine() << "\t" << k.GetKey() << EOL;
+				found = true;
+			});
+			if (!found)
+				out << model << "\t" << manufacturer << "\t-" << EOL;
+		};
+		for (const String& q : query)
+			Answer(q);
+		if (batch)
+			// The whole inventory against one collection.
+			while (!Cin().IsEof()) {
+				const String q = TrimBoth(Cin().GetLine());
+				if (!IsNull(q))
+					Answer(q);
+			}
+		out.Flush();
+		PutStats();
+		hd.StoreCache();
+		return;
+	}
+
+	if (!IsNull(diff_fn)) {
+		// A line per change, where the device is now, or was if it is gone.
+		hd.Diff(old, [](int c, const String& fn, const json::Key& k) {
+			Cout() << (char)c << "\t" << fn << ":" << k.GetLine() << "\t" << k.GetKey() << EOL;
+		});
+		PutStats();
+		hd.StoreCache();
+		return;
+	}
+
+	if (!IsNull(select)) {
+		hd.Select(select_field, select.Mid(q + 1), [](const String& fn, const json::Key& k) {
+			Cout() << fn << ":" << k.GetLine() << ": " << k.GetKey() << EOL;
+		});
+		PutStats();
+		hd.StoreCache();
+		return;
+	}
+
+	auto Output = [&] {
+		const Vector<String> text = hd.Populate(writer);
+		for (int i = 0; i < writer.GetCount(); ++i) {
+			if (port)
+				// The server has the list, stdout is only for the log.
+				srv.Set(writer[i]->GetExt(), writer[i]->GetContentType(), text[i]);
+			else if (use_cout) {
+				Cout().Put(text[i]);
+				Cout().Flush();
+			}
+			if (i < output.GetCount() && !SaveOutput(output[i], text[i]))
+				Cerr() << "Couldn't create file " << output[i] << EOL;
+		}
+		PutStats();
+		hd.StoreCache();
+		if (!IsNull(store_fn) && !hd.StoreSnapshot(store_fn))
+			Cerr() << "Couldn't store snapshot " << store_fn << EOL;
+	};
+	Output();
+
+	if (port)
+		Thread::Start([&] { srv.Run(); });
+	Index<String> pending;              // Changed files of the passes that failed.
+	while (watch || port) {
+		bool ok;
+		if (watch) {
+			for (const String& fn : dw.Wait())
+				pending.FindAdd(fn);
+			if (pending.IsEmpty())
+				continue;
+			ok = hd.UpdateDir(dn, pending);
+			if (ok)
+				pending.Clear();
+		}
+		else {
+			Sleep(1000 * interval);
+			ok = Collect();
+		}
+		if (!ok) {
+			// Most likely an edit in progress or a network hiccup, the output is kept until the next pass.
+			Cerr() << "Couldn't collect data." << EOL;
+			continue;
+		}
+		Output();
+	}
+}
+
+#endif
@@ -0,0 +1,462 @@
+// vi set: noexpandtab
+// License: BSD license
+// Author: Sergey Sikorskiy
+#ifndef _hddl_hddl_h_
+#define _hddl_hddl_h_
+
+#include <Core/Core.h>
+
+using namespace Upp;
+
+namespace json {
+
+    struct Key : Moveable<Key>, ValueType<Key, 10011> {
+        Key(const Nuller&)                  { key = Null; line = Null; }
+        Key(const String& key, int line) : key(key), line(line) {}
+        // Refers to len bytes at ptr, the buffer has to outlive the key.
+        Key(const char *ptr, int len, int line) : line(line), ptr(ptr), len(len) {}
+        Key() {}
+
+        // We provide these methods to allow automatic conversion of Key to/from Value
+        operator Value() const              { return RichToValue(*this); }
+        Key(const Value& v)                 { *this = v.Get<Key>(); }
+
+        String ToString() const             { return GetKey(); }
+        unsigned GetHashValue() const       { return GetKey().GetHashValue(); }
+        void Serialize(Stream& s)           { if (ptr) *this = Key(GetKey(), line); s % key % line; }
+        bool operator==(const Key& b) const { return GetLength() == b.GetLength() && memcmp(GetText(), b.GetText(), GetLength()) == 0; }
+        bool IsNullInstance() const         { return !ptr && IsNull(key) && IsNull(line); }
+        int  Compare(const Key& b) const    { return GetKey().Compare(b.GetKey()); }
+        // This type does not define XML nor Json serialization
+
+        String GetKey() const { return ptr ? String(ptr, len) : key; }
+        const char *GetText() const { return ptr ? ptr : ~key; }
+        int GetLength() const { return ptr ? len : key.GetCount(); }
+        int GetLine() const { return line; }
+
+    protected:
+        String key;
+        int line;
+        const char *ptr = NULL;
+        int len = 0;
+    };
+
+    // Parses a Value tree, the members of objects are keyed by Key, so they have their line.
+    Value Parse(CParser& p);
+    // ErrorValue if s isn't valid JSON.
+    Value Parse(const char *s);
+    // The same with a stack of its own instead of recursion, nesting deeper than max_depth is an
+    // error. With strict, the stray ',' at the end of objects and arrays that Parse allows is too.
+    Value Parse(CParser& p, int max_depth, bool strict = false);
+    Value Parse(const char *s, int max_depth, bool strict = false);
+
+    // Bump allocator for the text of keys. Memory is taken in blocks that grow up to 64KB and
+    // is released all at once, together with the arena. Pointers stay valid until then.
+    class Arena {
+    public:
+        // Never NULL, not even for n == 0, so it can be the target of any memcpy.
+        char *Alloc(int n);
+        void Clear()                        { block.Clear(); ptr = end = NULL; }
+
+    protected:
+        Vector<Buffer<char>> block;
+        char *ptr = NULL;
+        char *end = NULL;
+    };
+
+    // Reads a JSON document in place, from begin to end, without building a Value tree.
+    // Strings are returned as raw ranges of the input and the values nobody asks for are
+    // skipped without allocating. Whitespace, comments and errors follow CParser.
+    // Lines are not tracked while scanning, GetLine counts them from the last position asked for.
+    class Scanner {
+    public:
+        Scanner(const char *begin, const char *end) : ptr(begin), end(end), lptr(begin) { Spaces(); }
+
+        bool IsEof() const                  { return ptr >= end; }
+        bool IsChar(char c) const           { return ptr < end && *ptr == c; }
+        bool IsString() const               { return IsChar('\"'); }
+        bool Char(char c);
+        void PassChar(char c);
+        // Reads a string literal as the range between its quotes, returns true if it has escapes.
+        bool ReadText(const char *& b, const char *& e);
+        String Decode(const char *b, const char *e);
+        // Decodes into t, which has room for e - b bytes, returns the end of the result.
+        char  *Decode(const char *b, const char *e, char *t);
+        void SkipValue();
+        const char *GetPtr() const          { return ptr; }
+        int  GetLine()                      { return GetLine(ptr); }
+        // Line of pos, which is not before the position last asked for.
+        int  GetLine(const char *pos);
+        void ThrowError(const char *s);
+
+    protected:
+        const char *ptr;
+        const char *end;
+        const char *lptr;               // Lines are counted up to here.
+        int line = 1;                   // Line at lptr.
+
+        void Spaces();
+        int  ReadHex4(const char *& s, const char *e);
+    };
+
+    // Walks a device file, { "...": [ { "description": "...", ... }, ... ], ... }, and reports the
+    // first description of every device object with the line of its key. Returns the number of
+    // members of the top level object or -1 if the document is not an object.
+    // Descriptions are copied to the arena or, with view, those without escapes refer to the input.
+    // The string values of the members named in fields, or the strings of an array there, are
+    // reported after the description of their device, with the index of the field.
+    int Extract(Scanner& p, const Event<const Key&>& description, Arena& arena, bool view = false,
+                const Vector<String> *fields = NULL, const Event<int, const String&>& value = Event<int, const String&>());
+    // Walks an array of objects, e.g. a GitHub contents listing, and reports the string values of
+    // the members named in fields of every object, by index of the field and empty if missing.
+    // Returns the number of elements or -1 if the document is not an array.
+    int ExtractArray(Scanner& p, const Vector<String>& fields, const Event<const Vector<String>&>& element);
+
+}
+
+// Extracted device fields by column. A column holds the values of one field for a run of
+// devices as ids of strings in a pool, so a scan of a field reads contiguous memory. The
+// values of device i start at value[begin[i]] and end where the next device starts.
+struct Columns : Moveable<Columns> {
+    struct Column : Moveable<Column> {
+        Vector<int> begin;
+        Vector<int> value;
+
+        int  GetEnd(int i) const        { return i + 1 < begin.GetCount() ? begin[i + 1] : value.GetCount(); }
+        void Serialize(Stream& s)       { s % begin % value; }
+    };
+    Vector<Column> column;              // By field.
+
+    void AddRow()                       { for (Column& c : column) c.begin.Add(c.value.GetCount()); }
+    // Appends the rows of src, map turns its string ids into the ids of this pool.
+    void Append(const Columns& src, const Vector<int>& map);
+    // Appends row of src alone, a row without values if src has no such column.
+    void AppendRow(const Columns& src, int row, const Vector<int>& map);
+    void Serialize(Stream& s)           { s % column; }
+};
+
+// Field values of the devices of a section, and where they come from, as writers see them.
+struct FieldValues {
+    const Vector<String>& name;         // Field names, by column.
+    const Index<String>& pool;
+    const Columns *attr;                // NULL if the section has no devices.
+    const Vector<String>& link;         // Link to the file of every source, up to the line number.
+    const Vector<int> *source;          // Source of every device, NULL if all are from the first.
+
+    // Link of device i, its line number follows.
+    const String& GetLink(int i) const  { return link[source && i < source->GetCount() ? (*source)[i] : 0]; }
+
+    // Values of field f of device i.
+    Vector<String> Get(int f, int i) const {
+        Vector<String> r;
+        if (attr && f < attr->column.GetCount()) {
+            const Columns::Column& c = attr->column[f];
+            for (int j = c.begin[i], e = c.GetEnd(i); j < e; ++j)
+                r.Add(pool[c.value[j]]);
+        }
+        return r;
+    }
+};
+
+// Renders the list in one output format. Sections are rendered on their own, so they can be
+// cached and reused, the rest goes around them.
+struct Writer {
+    virtual ~Writer() {}
+
+    virtual const char *GetExt() const = 0;
+    virtual const char *GetContentType() const = 0;
+    // Bytes per device on top of its name, the link and the file name, to presize the output.
+    virtual int  GetOverhead() const                                        { return 16; }
+    virtual void Header(StringBuffer& out, const Vector<String>& field) const {}
+    // Link prefix as it goes into the output, the line number follows.
+    virtual String Link(const String& url) const                            { return url; }
+    virtual void Separator(StringBuffer& out) const                         {}
+    virtual void Section(StringBuffer& out, const String& fn, const String& alias, const Vector<json::Key>& kv, const FieldValues& fields) const = 0;
+    virtual void Footer(StringBuffer& out) const                            {}
+};
+
+// Writer for an extension, NULL if there is none.
+const Writer *GetWriter(const String& ext);
+
+// Timings and counters of a collection and its rendering. Times are in microseconds of wall
+// clock, the download phases of a file overlap with those of the other connections.
+struct Stats {
+    // Download phases, as far as HttpRequest tells them apart. The connect is in DNS.
+    enum { DNS, TLS, REQUEST, WAIT, TRANSFER, PHASE_COUNT };
+
+    struct File : Moveable<File> {
+        String fin;
+        bool cached = false;
+        int64 bytes = 0;
+        int devices = 0;
+        int64 download[PHASE_COUNT] = {};
+        int64 parse = 0;                // json::Extract alone.
+        int64 content = 0;              // CollectContent, the parse and the hash.
+    };
+
+    int64 listing = 0;                  // Contents listing request and its parse.
+    int64 fetch = 0;
+    int64 collect = 0;
+    int64 populate = 0;
+    int64 load = 0;                     // Snapshot.
+    String commit;                      // Of the archive collected.
+    Vector<File> file;
+
+    // Our download phase of an HttpRequest phase.
+    static int GetPhase(int http_phase);
+    String ToJSON() const;
+};
+
+// Paces the requests to a server by the X-RateLimit headers of its responses, and tells how long
+// to back off before a failed request is repeated. Times are in microseconds of usecs(). Threads
+// requesting from the same server share one.
+struct RateLimit {
+    enum { MAX_ATTEMPTS = 6 };
+
+    // Before which no request should start.
+    int64 GetNext() const               { Mutex::Lock __(lock); return next; }
+    // A request starts now.
+    void  Start()                       { Mutex::Lock __(lock); next = max(next, usecs()) + interval; }
+    // Waits until a request may start, and starts it.
+    void  Wait();
+    // Takes the remaining budget and the time of its reset from the response of h.
+    void  Update(HttpRequest& h);
+    // How long to wait before the attempt-th repetition of the request that h failed, Null if it
+    // is not worth repeating. Jittered and doubled with every attempt, and at least as long as
+    // the server asks for.
+    int64 GetBackoff(HttpRequest& h, int attempt) const;
+
+private:
+    mutable Mutex lock;
+    int64 next = 0;
+    int64 interval = 0;                 // Between requests, when the budget runs low.
+};
+
+// A RateLimit for each host.
+struct RateLimits {
+    // Of the host of url.
+    RateLimit& Get(const String& url);
+
+private:
+    Mutex lock;
+    ArrayMap<String, RateLimit> host;
+};
+
+// Where device files come from: a GitHub repository, read by its contents listing or as one
+// archive, a local directory or a single file URL.
+struct Source : Moveable<Source> {
+    enum { GITHUB, TARBALL, DIR, URL };
+
+    int    kind = GITHUB;
+    String location = "u236/homed-service-zigbee"; // owner/repo, directory or URL.
+    String ref;                         // Branch, tag or commit, Null for the default branch.
+    String path = "deploy/data/usr/share/homed-zigbee"; // Of the files in the repository.
+    String link;                        // Link prefix of the files, Null to derive it.
+
+    // Prefix of the links to the files, their names follow. Null for a directory without a
+    // link, it gets the upstream one.
+    String GetBlobUrl() const;
+    String ToString() const;
+    // The upstream repository with no link of its own, the configured link replaces its one.
+    bool   IsUpstream() const;
+};
+
+// Reads a source per line, "github|tarball owner/repo [ref [path]]", "dir directory [link]" or
+// "url url [link]". Empty lines and those starting with '#' are skipped.
+bool LoadSources(const String& fn, Vector<Source>& sv);
+
+// Settings in place of the built-in ones.
+struct Config {
+    VectorMap<String, String> alias;    // Vendor names, by file name.
+    String link;                        // Link prefix of the upstream files, Null for the built-in one.
+};
+
+// Reads a setting per line, "vendor file alias" or "link url". Empty lines and those starting
+// with '#' are skipped.
+bool LoadConfig(const String& fn, Config& cfg);
+
+struct HOMEd {
+    HOMEd& Jobs(int n)                  { jobs = max(n, 1); return *this; }
+    HOMEd& CacheDir(const String& dn)   { cache_dir = dn; return *this; }
+    HOMEd& ZeroCopy(bool b = true)      { zero_copy = b; return *this; }
+    // Vendor names and links on top of the built-in ones, cfg has to outlive the list. Before From.
+    HOMEd& Configure(const Config& cfg) { config = &cfg; return *this; }
+    // Device fields to extract besides the description, e.g. modelNames.
+    HOMEd& Fields(const Vector<String>& f) { field = clone(f); return *this; }
+    // Where CollectSource and the GitHub collections take the files from, and the links to them.
+    HOMEd& From(const Source& s);
+
+    bool CollectDir(const String& dn);
+    // Collects the directory again, reading only the files that changed or are new.
+    bool UpdateDir(const String& dn, const Index<String>& changed);
+    bool CollectGitHub();
+    // Collects the files of one commit from the archive of the ref of the source.
+    bool CollectTarball();
+    bool CollectUrl();
+    // Collects whatever kind of source From set, GitHub upstream by default.
+    bool CollectSource();
+    // Collects every source at once into one list. A device, by file and description, that is
+    // in several sources is listed from the first one. Each source has a cache of its own.
+    bool CollectSources(const Vector<Source>& sv);
+    // Renders the list with every writer in wv.
+    Vector<String> Populate(const Vector<const Writer *>& wv);
+    void StoreCache();
+    // A snapshot is the collected index alone, loading it replaces collecting.
+    bool StoreSnapshot(const String& fn);
+    bool LoadSnapshot(const String& fn);
+    void Serialize(Stream& s);
+    // Reports the devices that have value among the values of field, by section and key.
+    void Select(const String& name, const String& value, const Event<const String&, const json::Key&>& match) const;
+    // Hashes every modelNames value, alone and with each of the manufacturerNames of its device,
+    // to the devices. Needs both fields extracted, collecting again drops it.
+    void BuildLookup();
+    // Reports the devices of model, made by manufacturer unless it is Null, by section and key.
+    void Lookup(const String& model, const String& manufacturer, const Event<const String&, const json::Key&>& match) const;
+    // Reports what changed since the list old, usually a snapshot, by '+' for added, '-' for
+    // removed and '~' for changed devices, with section and key. A device is known by its
+    // modelNames if both lists have them, by its description otherwise. The added and changed
+    // ones come in the order of this list, then the removed ones in that of old.
+    void Diff(const HOMEd& old, const Event<int, const String&, const json::Key&>& change) const;
+    // Of the last collection, and the rendering after it.
+    const Stats& GetStats() const       { return stats; }
+    // Extracted device fields, those of the snapshot after LoadSnapshot.
+    const Vector<String>& GetFields() const { return field; }
+
+protected:
+    struct File : Moveable<File> {
+        String fn;
+        String fin;                     // Download URL or local path.
+        String sha;
+        String etag;
+        String content;
+        One<FileMapping> map;           // Mapped local file, its bytes are at begin/end.
+        const char *begin = NULL;
+        const char *end = NULL;
+        int64 hash = Null;
+        bool cached = false;
+        json::Arena arena;              // Text of the keys that don't refer to the content.
+        Stats::File stat;
+
+        const char *Begin() const       { return map ? begin : content.Begin(); }
+        const char *End() const         { return map ? end : content.End(); }
+    };
+
+    // What is remembered about a file between runs.
+    struct Entry : Moveable<Entry> {
+        String sha;                     // Blob sha from the contents listing.
+        String etag;
+        int64 hash = Null;              // Hash of the content the keys were extracted from.
+        Vector<json::Key> keys;
+        Index<String> pool;             // Strings of the field values.
+        Columns attr;                   // Field values, a row per key.
+
+        void Serialize(Stream& s)       { s % sha % etag % hash % keys % pool % attr; }
+    };
+
+    // A section of the list, the devices of the files of one name. Vendors are known by their
+    // index, which stays the same as long as no vendor is added or removed. The built-in and
+    // configured ones are added when the list is rendered, even if they have no devices.
+    struct Vendor : Moveable<Vendor> {
+        String alias;
+        int64  hash = 0;                // Combined hash of the contributing files.
+        Vector<json::Key> keys;
+        Columns attr;                   // Field values, a row per key.
+        Vector<int> source;             // Source of every key, empty if there is one source.
+        bool seen = true;               // A file of the name was in the last collection.
+
+        void Serialize(Stream& s)       { s % alias % hash % keys % attr % source; }
+    };
+
+    // Rendered Markdown of a section.
+    struct Section : Moveable<Section> {
+        int64 hash = Null;              // Combined hash of the contributing files.
+        String alias;
+        String text;
+
+        void Serialize(Stream& s)       { s % hash % alias % text; }
+    };
+
+    struct Cache {
+        String etag;                    // ETag of the contents listing.
+        String listing;
+        VectorMap<String, Entry> entry;
+        VectorMap<String, Section> section;
+        Vector<String> field;           // Fields the entries have.
+
+        void Serialize(Stream& s);
+    };
+
+    String GetCachePath() const         { return AppendFileName(cache_dir, "hddl.cache"); }
+    void LoadCache();
+
+    // GETs url, If-None-Match etag unless it is Null, and repeats the request after a backoff as
+    // long as it fails in a way worth repeating. done tells whether a response is final. Returns
+    // what HttpRequest::Execute does for the last attempt.
+    String Execute(HttpRequest& http, const String& url, const String& etag, const Gate<>& done);
+    // Downloads the files that aren't cached, done gets the index of every file once it is ready.
+    bool Fetch(Vector<File>& fv, const Event<int>& done);
+    // Fetches fv and parses every file as soon as it is here.
+    bool FetchContent(Vector<File>& fv);
+    bool Extract(const String& fin, const char *b, const char *e, json::Arena& arena, Entry& en);
+    // Configured or built-in alias of file name fn, or the title of the file.
+    String GetAlias(const String& fn) const;
+    // Vendor of file name fn, a new one is added with its alias.
+    Vendor& GetVendor(const String& fn);
+    // Drops the devices, the vendors stay until the list is rendered without their files.
+    void ClearList();
+    // Prefix of the links to the upstream files.
+    String GetUpstreamUrl() const;
+    void Merge(const String& fn, const Entry& e);
+    // Replaces the collection with the entries of fv, unless failed.
+    bool Merge(Vector<File>& fv, Vector<Entry>& ev, bool failed);
+    bool Collect(Vector<File>& fv);
+    bool ScanDir(const String& dn, const Index<String> *changed);
+    bool Load(File& f);
+    bool CollectContent(File& f, Entry& e);
+    void Populate(StringBuffer& out, const Writer& w, int id, const Vector<String>& url, int64 salt,
+                  VectorMap<String, Section>& section);
+    // Paces the requests of the collection, the parts of CollectSources share those of the whole.
+    RateLimit& GetLimit(const String& url) { return (shared_limits ? *shared_limits : limits).Get(url); }
+
+protected:
+    int jobs = 1;
+    bool zero_copy = false;
+    const Config *config = NULL;
+    String cache_dir;
+    Cache cache;
+    VectorMap<String, File> buffer;     // Files the keys refer to, their arenas and zero copy content.
+    VectorMap<String, Vendor> vendor;   // By file name.
+    Vector<int> order;                  // Vendors in the order of the list, empty until sorted.
+    Vector<String> field;
+    Index<String> pool;                 // Strings of the field values of all sections.
+    Vector<String> blob;                // Link prefix of every source.
+    Source source;
+    Array<HOMEd> part;                  // Collections of the sources, the keys refer to them.
+
+    // A device, as a vendor and a row in it.
+    struct Ref : Moveable<Ref> {
+        int section;
+        int row;
+    };
+
+    // Hashes of what a device is known by and of what it is, for Diff.
+    struct Device : Moveable<Device> {
+        uint64 id;
+        uint64 content;                 // Section, description and the values of the compared fields.
+        Ref    ref;
+    };
+
+    // Every device, with the values of fields in content.
+    Vector<Device> GetDevices(const Vector<String>& fields, bool by_model) const;
+    Index<uint64> lookup;               // Pool ids of a model and a manufacturer, or ~0.
+    Vector<Vector<Ref>> lookup_ref;     // Devices of lookup, by its index.
+    RateLimits limits;
+    RateLimits *shared_limits = NULL;   // Of the collection this one is a part of.
+    Stats stats;
+}; // struct HOMEd
+
+// Writes the whole text at once. It goes to a temporary file next to fn first, which then
+// replaces fn, so readers see either the previous version or the new one.
+bool SaveOutput(const String& fn, const String& text);
+
+#endif